@@ -0,0 +1,93 @@
+/*
+ * @file arena.c
+ * @brief Bump allocator for the data of one command line
+ *
+ * parse_line takes the CMD nodes, the argv strings and the file names from
+ * line_arena; after the line is executed the arena is reset, its chunks are
+ * kept and reused by the next line, so the prompt loop does not call malloc
+ * once the arena is big enough for the usual lines.
+ */
+
+#include "header.h"
+
+ARENA line_arena = {NULL, NULL};
+
+/*
+ * @brief allocate memory from the arena
+ * @param ARENA* a - arena
+ * @param size_t size - bytes
+ * @return memory aligned to 16 bytes, valid until arena_reset()
+ */
+void *arena_alloc(ARENA *a, size_t size)
+{
+    ARENACHUNK *c = a->current;
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    // use the next chunks kept by arena_reset() before allocating a new one
+    while (c != NULL && c->used + size > c->size)
+    {
+        c = c->next;
+        if (c != NULL)
+            c->used = 0;
+    }
+    if (c == NULL)
+    {
+        size_t chunk = size > ARENA_CHUNK ? size : ARENA_CHUNK;
+        c = malloc(sizeof(ARENACHUNK) + chunk);
+        if (c == NULL)
+        {
+            perror("malloc error!\n");
+            exit(1);
+        }
+        c->size = chunk;
+        c->used = 0;
+        c->next = NULL;
+        if (a->current != NULL)
+        {
+            // keep the list order: new chunk after the last one
+            ARENACHUNK *last = a->current;
+            while (last->next != NULL)
+                last = last->next;
+            last->next = c;
+        }
+        else
+            a->head = c;
+    }
+    a->current = c;
+    p = c->data + c->used;
+    c->used += size;
+    return p;
+}
+
+/*
+ * @brief copy n bytes of a string to the arena
+ */
+char *arena_strndup(ARENA *a, const char *s, size_t n)
+{
+    char *p = arena_alloc(a, n + 1);
+
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+/*
+ * @brief copy a string to the arena
+ */
+char *arena_strdup(ARENA *a, const char *s)
+{
+    return arena_strndup(a, s, strlen(s));
+}
+
+/*
+ * @brief free everything allocated from the arena at once
+ *
+ * the chunks are not returned to malloc, the next allocations reuse them
+ */
+void arena_reset(ARENA *a)
+{
+    a->current = a->head;
+    if (a->head != NULL)
+        a->head->used = 0;
+}
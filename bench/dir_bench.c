@@ -0,0 +1,206 @@
+/*
+ * @file dir_bench.c
+ * @brief System calls and time of a tree walk: opendir/readdir against dirread.c
+ *
+ * usage: dir_bench [depth fanout files]
+ *
+ * a tree of the given shape (default 3 8 16) is made in a temporary
+ * directory and walked the way myfind does it: every entry is looked at
+ * once, the directories are entered by their path. The system calls are
+ * counted by tracing a child that does one walk (ptrace, minus the calls of
+ * a child that does not walk); the time is the median of in-process walks.
+ */
+
+#include "../header.h"
+#include <ftw.h>
+#include <sys/ptrace.h>
+
+#define RUNS 9
+
+// globals of the shell that header.h declares
+char **directories;
+DIRINDEX *dir_index;
+int last_status;
+OPTIONS options;
+
+static long make_tree(const char *root, int depth, int fanout, int files)
+{
+    char path[4096];
+    long count = 0;
+    int i, fd;
+
+    for (i = 0; i < files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%d.c", root, i);
+        if ((fd = open(path, O_CREAT | O_WRONLY, 0644)) != -1)
+            close(fd);
+        count++;
+    }
+    if (depth == 0)
+        return count;
+    for (i = 0; i < fanout; i++)
+    {
+        snprintf(path, sizeof(path), "%s/dir%d", root, i);
+        mkdir(path, 0755);
+        count += 1 + make_tree(path, depth - 1, fanout, files);
+    }
+    return count;
+}
+
+static long walk_readdir(const char *path)
+{
+    char sub[4096];
+    struct dirent *entry;
+    long count = 0;
+    DIR *dir;
+
+    if ((dir = opendir(path)) == NULL)
+        return 0;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        count++;
+        if (entry->d_type == DT_DIR)
+        {
+            snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name);
+            count += walk_readdir(sub);
+        }
+    }
+    closedir(dir);
+    return count;
+}
+
+static long walk_dirread(const char *path)
+{
+    char sub[4096];
+    struct dirent64 *entry;
+    long count = 0;
+    DIRREAD dir;
+
+    if (dir_open(&dir, AT_FDCWD, path) == -1)
+        return 0;
+    while ((entry = dir_next(&dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        count++;
+        if (entry->d_type == DT_DIR)
+        {
+            snprintf(sub, sizeof(sub), "%s/%s", path, entry->d_name);
+            count += walk_dirread(sub);
+        }
+    }
+    dir_close(&dir);
+    return count;
+}
+
+/*
+ * @brief system calls made by a child that runs walk (or nothing) on root
+ */
+static long count_syscalls(long (*walk)(const char *), const char *root)
+{
+    int status;
+    long n = 0;
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        if (walk != NULL)
+            walk(root);
+        _exit(0);
+    }
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, PTRACE_O_TRACESYSGOOD);
+    for (;;)
+    {
+        if (ptrace(PTRACE_SYSCALL, pid, NULL, NULL) == -1 || waitpid(pid, &status, 0) == -1)
+            return -1;
+        if (WIFEXITED(status) || WIFSIGNALED(status))
+            break;
+        if (WIFSTOPPED(status) && WSTOPSIG(status) == (SIGTRAP | 0x80))
+            n++;
+    }
+    return n / 2; // a stop at the entry and one at the exit (exit_group has no exit)
+}
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median_us(long (*walk)(const char *), const char *root)
+{
+    double t[RUNS], start;
+    int i;
+
+    for (i = 0; i < RUNS; i++)
+    {
+        start = now_us();
+        walk(root);
+        t[i] = now_us() - start;
+    }
+    qsort(t, RUNS, sizeof(double), compare_double);
+    return t[RUNS / 2];
+}
+
+static int remove_entry(const char *path, const struct stat *sb, int flag, struct FTW *ftw)
+{
+    return remove(path);
+}
+
+int main(int argc, char *argv[])
+{
+    char root[] = "/tmp/dir_bench.XXXXXX";
+    int depth = 3, fanout = 8, files = 16;
+    long entries, base, calls_readdir, calls_dirread;
+
+    if (argc == 4)
+    {
+        depth = atoi(argv[1]);
+        fanout = atoi(argv[2]);
+        files = atoi(argv[3]);
+    }
+    else if (argc != 1)
+    {
+        fprintf(stderr, "usage: dir_bench [depth fanout files]\n");
+        return 2;
+    }
+    if (mkdtemp(root) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    entries = make_tree(root, depth, fanout, files);
+    walk_readdir(root); // warm the dentry cache
+
+    base = count_syscalls(NULL, root);
+    calls_readdir = count_syscalls(walk_readdir, root) - base;
+    calls_dirread = count_syscalls(walk_dirread, root) - base;
+
+    printf("tree: depth=%d fanout=%d files=%d, %ld entries\n", depth, fanout, files, entries);
+    printf("%-10s %10s %10s %10s\n", "reader", "syscalls", "per entry", "time ms");
+    if (base < 0)
+    {
+        printf("(ptrace not permitted, no system call counts)\n");
+        calls_readdir = calls_dirread = 0;
+    }
+    printf("%-10s %10ld %10.3f %10.3f\n", "readdir", calls_readdir, (double)calls_readdir / entries,
+           median_us(walk_readdir, root) / 1000);
+    printf("%-10s %10ld %10.3f %10.3f\n", "dirread", calls_dirread, (double)calls_dirread / entries,
+           median_us(walk_dirread, root) / 1000);
+    printf("dirread counted %ld calls of its own per walk\n", atomic_load(&dir_syscalls) / RUNS);
+
+    nftw(root, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * @file lex_bench.c
+ * @brief parse_line (lexer + arena) against the old strtok/strdup tokenizer
+ *
+ * usage: lex_bench [iterations] [line_bytes ...]
+ *
+ * the lines are words, pipes and redirections, with no quotes, so the old
+ * tokenizer can read them too
+ */
+
+#include "../header.h"
+#include <time.h>
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * @brief tokenizer of parse.c before the lexer: strtok and one strdup per token
+ */
+static int old_tokenize(char *line)
+{
+    char *tokens[4096];
+    char *a;
+    int n = 0, i;
+
+    for (a = strtok(line, " \t\r\n"); a; a = strtok(NULL, " \t\r\n"))
+    {
+        if (n < 4096)
+            tokens[n++] = strdup(a);
+    }
+    for (i = 0; i < n; i++)
+        free(tokens[i]);
+    return n;
+}
+
+/*
+ * @brief generate a line of about size bytes
+ */
+static char *make_line(int size)
+{
+    static const char *words[] = {"grep", "-v", "foo", "|", "sort", "-u", "<", "input.txt", "arg", "2>", "err.log", "--option=value"};
+    char *line = malloc(size + 32);
+    int len = 0, w = 0;
+
+    while (len < size)
+        len += sprintf(line + len, "%s ", words[w++ % 12]);
+    return line;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 20000;
+    static const int sizes[] = {1024, 4096, 16384};
+    int nsizes = argc > 2 ? argc - 2 : 3;
+    int i, k;
+
+    printf("%10s %14s %14s\n", "line_bytes", "strtok_ns", "lexer_ns");
+    for (k = 0; k < nsizes; k++)
+    {
+        int size = argc > 2 ? atoi(argv[k + 2]) : sizes[k];
+        char *line = make_line(size);
+        char *copy = malloc(strlen(line) + 1);
+        double start, old_ns, new_ns;
+
+        start = now_us();
+        for (i = 0; i < iterations; i++)
+        {
+            strcpy(copy, line);
+            old_tokenize(copy);
+        }
+        old_ns = (now_us() - start) * 1000 / iterations;
+
+        start = now_us();
+        for (i = 0; i < iterations; i++)
+        {
+            strcpy(copy, line);
+            free_command_list(parse_line(copy));
+        }
+        new_ns = (now_us() - start) * 1000 / iterations;
+
+        printf("%10d %14.0f %14.0f\n", size, old_ns, new_ns);
+        free(copy);
+        free(line);
+    }
+    return 0;
+}
@@ -0,0 +1,639 @@
+/*
+ * @file msh_bench.c
+ * @brief Benchmark suite of the shell (make bench)
+ *
+ * usage: msh_bench [-json] [suite ...]
+ *
+ * suites (all of them without arguments):
+ *   startup   - index_build() over a generated $PATH, without (cold) and with (warm) ~/.msh_cache
+ *   complete  - character_name_generator() over a synthetic dictionary, file_name_generator()
+ *               over a directory of as many files (cached listing against readline's own)
+ *   parse     - parse_line() throughput
+ *   pipeline  - exec_comandos() latency, ./output running a script of pipelines of /bin/true
+ *               (a process per stage): one process, a pipeline and every stage after the first
+ *   traverse  - myls -R and myfind (walk, predicates, --index refresh, --locate)
+ *               wall time over a generated tree, run by ./output
+ *   listing   - myls and myls -l of one huge directory into /dev/null, run by ./output
+ *   history   - history_init() and history_find() over a generated ~/.msh_history:
+ *               startup, first search (a scan), index build and size, substring queries
+ *               with and without the index
+ *
+ * sizes come from the environment (make bench VAR=value):
+ *   BENCH_PATH="dirs files"          default "16 256"
+ *   BENCH_DICT=names                 default 50000
+ *   BENCH_PARSE=lines                default 200000
+ *   BENCH_PIPE="lines stages"        default "200 3"
+ *   BENCH_TREE="depth fanout files"  default "3 8 16"
+ *   BENCH_LIST=files                 default 100000
+ *   BENCH_HIST=lines                 default 1000000
+ *   BENCH_RUNS=runs                  default 5, the median is reported
+ *   BENCH_TIMEOUT=seconds            default 60, a shell still running is killed
+ *   MSH=shell                        default ./output
+ *
+ * every result is one line: suite, parameters, value and unit, or one JSON
+ * object per line with -json. The modules of the shell are linked in (startup,
+ * complete, parse, history), the rest drives the shell binary end to end.
+ */
+
+#include "../header.h"
+#include <time.h>
+
+char **directories = NULL;
+DIRINDEX *dir_index = NULL;
+int last_status = 0;
+
+static int json = 0;
+static int runs = 5;
+static int timeout = 60;
+static char workdir[] = "/tmp/msh_bench.XXXXXX";
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void result(const char *suite, const char *params, double value, const char *unit)
+{
+    if (json)
+        printf("{\"suite\":\"%s\",\"params\":\"%s\",\"value\":%.3f,\"unit\":\"%s\"}\n", suite, params, value, unit);
+    else
+        printf("%-10s %-34s %14.3f %s\n", suite, params, value, unit);
+    fflush(stdout);
+}
+
+static int env_ints(const char *name, const char *def, int *v, int n)
+{
+    const char *s = getenv(name);
+    char *end;
+    int i;
+
+    if (s == NULL || *s == '\0')
+        s = def;
+    for (i = 0; i < n; i++)
+    {
+        v[i] = strtol(s, &end, 10);
+        if (end == s)
+            return -1;
+        s = end;
+    }
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double median(double *v, int n)
+{
+    qsort(v, n, sizeof(double), cmp_double);
+    return v[n / 2];
+}
+
+/*
+ * @brief deterministic pseudo random numbers, the same data on every run
+ */
+static unsigned int rnd()
+{
+    static unsigned int seed = 12345;
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+static void random_name(char *name)
+{
+    int len = 3 + rnd() % 10, i;
+
+    for (i = 0; i < len; i++)
+        name[i] = 'a' + rnd() % 26;
+    name[len] = '\0';
+}
+
+static void touch(const char *file, mode_t mode)
+{
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, mode);
+    if (fd != -1)
+        close(fd);
+}
+
+/*
+ * @brief run the shell with a script
+ * @return wall time in microseconds, -1 if it was killed after BENCH_TIMEOUT
+ *
+ * SIGCHLD is blocked in main(), the end of the child is waited with sigtimedwait()
+ */
+static double run_shell(const char *script)
+{
+    const char *msh = getenv("MSH") ? getenv("MSH") : "./output";
+    char *argv[] = {(char *)msh, (char *)script, NULL};
+    posix_spawn_file_actions_t fa;
+    struct timespec limit = {timeout, 0};
+    sigset_t chld;
+    double start;
+    pid_t pid;
+
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, 1, "/dev/null", O_WRONLY, 0);
+    start = now_us();
+    if (posix_spawn(&pid, msh, &fa, NULL, argv, environ) != 0)
+    {
+        fprintf(stderr, "msh_bench: cannot run %s\n", msh);
+        exit(1);
+    }
+    posix_spawn_file_actions_destroy(&fa);
+    while (waitpid(pid, NULL, WNOHANG) == 0)
+    {
+        if (sigtimedwait(&chld, NULL, &limit) == -1 && errno == EAGAIN)
+        {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+            return -1;
+        }
+    }
+    return now_us() - start;
+}
+
+static double run_shell_median(const char *script)
+{
+    double t[runs];
+    int i;
+
+    for (i = 0; i < runs; i++)
+    {
+        if ((t[i] = run_shell(script)) < 0)
+            return -1;
+    }
+    return median(t, runs);
+}
+
+/*
+ * @brief index_build() in a child, so every run starts with an empty dictionary
+ */
+static double startup_once(int ndirs)
+{
+    int fds[2];
+    double t = 0;
+    pid_t pid;
+
+    if (pipe(fds) == -1)
+        return 0;
+    if ((pid = fork()) == 0)
+    {
+        double start = now_us();
+        index_build(ndirs);
+        t = now_us() - start;
+        write(fds[1], &t, sizeof(t));
+        _exit(0);
+    }
+    close(fds[1]);
+    read(fds[0], &t, sizeof(t));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    return t;
+}
+
+static void bench_startup()
+{
+    int size[2], i, j;
+    char path[512], params[64], cache[512];
+    double cold[runs], warm[runs];
+
+    if (env_ints("BENCH_PATH", "16 256", size, 2) == -1)
+        return;
+    setenv("HOME", workdir, 1);
+    snprintf(cache, sizeof(cache), "%s/%s", workdir, CACHE_FILE);
+    directories = malloc(size[0] * sizeof(char *));
+    dir_index = calloc(size[0], sizeof(DIRINDEX));
+    for (i = 0; i < size[0]; i++)
+    {
+        snprintf(path, sizeof(path), "%s/bin%d", workdir, i);
+        mkdir(path, 0755);
+        directories[i] = strdup(path);
+        for (j = 0; j < size[1]; j++)
+        {
+            snprintf(path, sizeof(path), "%s/bin%d/cmd%d_%d", workdir, i, i, j);
+            touch(path, 0755);
+        }
+    }
+    for (i = 0; i < runs; i++)
+    {
+        unlink(cache);
+        cold[i] = startup_once(size[0]);
+        warm[i] = startup_once(size[0]);
+    }
+    snprintf(params, sizeof(params), "dirs=%d files=%d cold", size[0], size[1]);
+    result("startup", params, median(cold, runs) / 1000, "ms");
+    snprintf(params, sizeof(params), "dirs=%d files=%d warm", size[0], size[1]);
+    result("startup", params, median(warm, runs) / 1000, "ms");
+}
+
+static void bench_complete()
+{
+    int n, i, k, len, queries = 20000, matches = 0;
+    char **names, *s, params[64], dir[512], path[600];
+    double start;
+
+    if (env_ints("BENCH_DICT", "50000", &n, 1) == -1)
+        return;
+    names = malloc(n * sizeof(char *));
+    for (i = 0; i < n; i++)
+    {
+        names[i] = malloc(16);
+        random_name(names[i]);
+    }
+    index_add(names, n);
+
+    for (len = 1; len <= 4; len++)
+    {
+        char prefix[16];
+        matches = 0;
+        start = now_us();
+        for (i = 0; i < queries; i++)
+        {
+            int state = 0;
+            strncpy(prefix, names[rnd() * 7 % n], len);
+            prefix[len] = '\0';
+            while ((s = character_name_generator(prefix, state++)) != NULL)
+            {
+                matches++;
+                free(s);
+            }
+        }
+        snprintf(params, sizeof(params), "names=%d prefix=%d matches=%d", n, len, matches / queries);
+        result("complete", params, (now_us() - start) * 1000 / queries, "ns/query");
+    }
+
+    // the same names as files, completed with a path (one TAB, all the matches)
+    snprintf(dir, sizeof(dir), "%s/names", workdir);
+    mkdir(dir, 0755);
+    for (i = 0; i < n; i++)
+    {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        touch(path, 0644);
+    }
+    for (k = 0; k < 2; k++)
+    {
+        char *(*generator)(const char *, int) = k == 0 ? file_name_generator : rl_filename_completion_function;
+        long reads = listing_reads;
+        queries = 200;
+        matches = 0;
+        start = now_us();
+        for (i = 0; i < queries; i++)
+        {
+            int state = 0;
+            snprintf(path, sizeof(path), "%s/%.2s", dir, names[rnd() * 7 % n]);
+            while ((s = generator(path, state++)) != NULL)
+            {
+                matches++;
+                free(s);
+            }
+        }
+        snprintf(params, sizeof(params), "files=%d prefix=2 %s", n, k == 0 ? "cached" : "readline");
+        result("complete", params, (now_us() - start) / queries, "us/query");
+        if (k == 0)
+            result("complete", params, listing_reads - reads, "directory reads");
+    }
+}
+
+static void bench_parse()
+{
+    static const char *lines[] = {
+        "ls -l /usr/bin",
+        "grep -v foo < input.txt | sort -u | uniq -c > out.txt 2> err.log",
+        "echo 'single quoted' \"double $quoted\" back\\ slash",
+        "myfind foo | wc -l",
+        "cat a b c d e f g h i j k l m n o p | head -n 10",
+    };
+    int n, i, k, nlines = sizeof(lines) / sizeof(lines[0]);
+    size_t bytes = 0;
+    char copy[256], params[64];
+    double start, us;
+
+    if (env_ints("BENCH_PARSE", "200000", &n, 1) == -1)
+        return;
+    start = now_us();
+    for (i = 0; i < n; i++)
+    {
+        k = i % nlines;
+        strcpy(copy, lines[k]);
+        bytes += strlen(copy);
+        free_command_list(parse_line(copy));
+    }
+    us = now_us() - start;
+    snprintf(params, sizeof(params), "lines=%d", n);
+    result("parse", params, n / us * 1e6, "lines/s");
+    result("parse", params, bytes / us, "MB/s");
+}
+
+static void bench_pipeline()
+{
+    int v[2], i, j;
+    char script[512], single[512], empty[512], params[64];
+    FILE *fp, *fs, *fe;
+    double base, one, t;
+
+    if (env_ints("BENCH_PIPE", "200 3", v, 2) == -1)
+        return;
+    if (v[1] < 2)
+        v[1] = 2;
+    snprintf(script, sizeof(script), "%s/pipeline.msh", workdir);
+    snprintf(single, sizeof(single), "%s/single.msh", workdir);
+    snprintf(empty, sizeof(empty), "%s/empty.msh", workdir);
+    fp = fopen(script, "w");
+    fs = fopen(single, "w");
+    fe = fopen(empty, "w");
+    // by absolute path: every stage is a process (true alone is a builtin)
+    for (i = 0; i < v[0]; i++)
+    {
+        fprintf(fp, "/bin/true");
+        for (j = 1; j < v[1]; j++)
+            fprintf(fp, " | /bin/true");
+        fprintf(fp, "\n");
+        fprintf(fs, "/bin/true\n");
+        fprintf(fe, "pwd\n");
+    }
+    fclose(fp);
+    fclose(fs);
+    fclose(fe);
+
+    // the startup of the shell and the reading of the script are taken out
+    base = run_shell_median(empty);
+    one = run_shell_median(single);
+    t = run_shell_median(script);
+    if (base < 0 || one < 0 || t < 0)
+    {
+        result("pipeline", "", -1, "timeout");
+        return;
+    }
+    result("pipeline", "stages=1", (one - base) / v[0], "us/process");
+    snprintf(params, sizeof(params), "stages=%d", v[1]);
+    result("pipeline", params, (t - base) / v[0], "us/pipeline");
+    // a pipeline of one process taken out: what every other stage adds
+    result("pipeline", params, (t - one) / v[0] / (v[1] - 1), "us/stage");
+}
+
+/*
+ * @brief generate a tree, files at every level
+ * @return number of entries created
+ */
+static long make_tree(const char *dir, int depth, int fanout, int files)
+{
+    char path[4096];
+    long count = 0;
+    int i;
+
+    for (i = 0; i < files; i++)
+    {
+        snprintf(path, sizeof(path), "%s/file%d%s", dir, i, i % 16 == 0 ? ".c" : "");
+        touch(path, 0644);
+        count++;
+    }
+    if (depth == 0)
+        return count;
+    for (i = 0; i < fanout; i++)
+    {
+        snprintf(path, sizeof(path), "%s/dir%d", dir, i);
+        mkdir(path, 0755);
+        count += 1 + make_tree(path, depth - 1, fanout, files);
+    }
+    return count;
+}
+
+static void bench_traverse()
+{
+    int v[3], i, locates = 50;
+    long entries;
+    char tree[512], script[512], params[96];
+    FILE *fp;
+    double base, t;
+
+    if (env_ints("BENCH_TREE", "3 8 16", v, 3) == -1)
+        return;
+    snprintf(tree, sizeof(tree), "%s/tree", workdir);
+    mkdir(tree, 0755);
+    entries = make_tree(tree, v[0], v[1], v[2]);
+    snprintf(params, sizeof(params), "depth=%d fanout=%d entries=%ld", v[0], v[1], entries);
+    snprintf(script, sizeof(script), "%s/traverse.msh", workdir);
+
+    fp = fopen(script, "w");
+    fprintf(fp, "cd %s\n", tree);
+    fclose(fp);
+    base = run_shell_median(script);
+
+    fp = fopen(script, "w");
+    fprintf(fp, "myls -R %s\n", tree);
+    fclose(fp);
+    t = run_shell_median(script);
+    result("myls-R", params, t < 0 ? -1 : (t - base) / 1000, t < 0 ? "timeout" : "ms");
+
+    fp = fopen(script, "w");
+    fprintf(fp, "cd %s\nmyfind file1.c\n", tree);
+    fclose(fp);
+    t = run_shell_median(script);
+    result("myfind", params, t < 0 ? -1 : (t - base) / 1000, t < 0 ? "timeout" : "ms");
+
+    // glob and type from d_type only, no stat; the files of the deepest
+    // directories are at depth + 1, the whole tree is walked
+    fp = fopen(script, "w");
+    fprintf(fp, "cd %s\nmyfind . -name file*.c -type f -maxdepth %d\n", tree, v[0] + 1);
+    fclose(fp);
+    t = run_shell_median(script);
+    result("myfind-pred", params, t < 0 ? -1 : (t - base) / 1000, t < 0 ? "timeout" : "ms");
+
+    // the database ($HOME is workdir): first build, then refreshes with nothing changed
+    fp = fopen(script, "w");
+    fprintf(fp, "cd %s\nmyfind --index %s\n", tree, tree);
+    fclose(fp);
+    t = run_shell_median(script);
+    result("myfind-index", params, t < 0 ? -1 : (t - base) / 1000, t < 0 ? "timeout" : "ms");
+
+    // a lookup is below the noise of a shell start: repeat it and report
+    // one, file0.c is in every directory
+    fp = fopen(script, "w");
+    fprintf(fp, "cd %s\n", tree);
+    for (i = 0; i < locates; i++)
+        fprintf(fp, "myfind --locate %s -name file0.c\n", tree);
+    fclose(fp);
+    t = run_shell_median(script);
+    if (t >= 0 && t < base)
+        t = base;
+    result("myfind-locate", params, t < 0 ? -1 : (t - base) / 1000 / locates,
+           t < 0 ? "timeout" : "ms");
+}
+
+static void bench_listing()
+{
+    int n, i;
+    char dir[512], file[600], script[512], params[64];
+    FILE *fp;
+    double base, t;
+
+    if (env_ints("BENCH_LIST", "100000", &n, 1) == -1)
+        return;
+    snprintf(dir, sizeof(dir), "%s/huge", workdir);
+    mkdir(dir, 0755);
+    for (i = 0; i < n; i++)
+    {
+        snprintf(file, sizeof(file), "%s/entry_%07d%s", dir, i, i % 10 == 0 ? ".sh" : "");
+        touch(file, i % 10 == 0 ? 0755 : 0644);
+    }
+    snprintf(params, sizeof(params), "files=%d", n);
+    snprintf(script, sizeof(script), "%s/listing.msh", workdir);
+
+    fp = fopen(script, "w");
+    fprintf(fp, "cd %s\n", dir);
+    fclose(fp);
+    base = run_shell_median(script);
+
+    fp = fopen(script, "w");
+    fprintf(fp, "myls %s\n", dir);
+    fclose(fp);
+    t = run_shell_median(script);
+    result("myls", params, t < 0 ? -1 : (t - base) / 1000, t < 0 ? "timeout" : "ms");
+
+    fp = fopen(script, "w");
+    fprintf(fp, "myls -l %s\n", dir);
+    fclose(fp);
+    t = run_shell_median(script);
+    result("myls-l", params, t < 0 ? -1 : (t - base) / 1000, t < 0 ? "timeout" : "ms");
+}
+
+static void bench_history()
+{
+    static const char *words[] = {"git", "make", "ls", "cd", "myfind", "grep", "-l", "-R", "src",
+                                  "commit", "push", "status", "bench", "output", "|", "wc", "sort"};
+    int n, i, k, w, nwords = sizeof(words) / sizeof(words[0]), queries = 1000, found, step, nnames = 0;
+    char file[600], line[256], params[64], query[16], (*names)[16];
+    const char *match;
+    size_t len;
+    double start, t[3];
+    FILE *fp;
+
+    if (env_ints("BENCH_HIST", "1000000", &n, 1) == -1)
+        return;
+    names = malloc(queries * sizeof(*names));
+    step = n / queries > 0 ? n / queries : 1; // one line in step gives a query
+    setenv("HOME", workdir, 1);
+    snprintf(file, sizeof(file), "%s/%s", workdir, HISTORY_FILE);
+    fp = fopen(file, "w");
+    for (i = 0; i < n; i++)
+    {
+        // a few words and a random name, some lines come back
+        for (line[0] = '\0', w = rnd() % 4 + 1, k = 0; k < w; k++)
+            strcat(strcat(line, words[rnd() % nwords]), " ");
+        random_name(line + strlen(line));
+        fprintf(fp, "%s\n", line);
+        if (i % step == 0 && nnames < queries)
+            strcpy(names[nnames++], strrchr(line, ' ') + 1);
+    }
+    fclose(fp);
+    snprintf(params, sizeof(params), "lines=%d", n);
+
+    start = now_us();
+    history_init(1);
+    result("history", params, (now_us() - start) / 1000, "ms startup");
+    // the first search starts the index thread and scans the whole file (no match)
+    start = now_us();
+    history_find("ZqZq", 0, &len);
+    result("history", params, (now_us() - start) / 1000, "ms first search");
+    history_index_wait();
+    result("history", params, (now_us() - start) / 1000, "ms index");
+    result("history", params, history_index_bytes() / 1048576.0, "MB index");
+
+    for (k = 2; k <= 6; k += 2)
+    {
+        // ends of the names of lines spread over the file: the rarer, the more the index helps
+        for (found = 0, i = 0; i < nnames; i++)
+        {
+            len = strlen(names[i]);
+            strcpy(query, names[i] + (len > (size_t)k ? len - k : 0));
+            start = now_us();
+            match = history_find(query, 0, &len);
+            t[0] = now_us() - start;
+            found += match != NULL;
+            if (i == 0 || t[0] > t[1])
+                t[1] = t[0];
+            t[2] = i == 0 ? t[0] : t[2] + t[0];
+        }
+        snprintf(params, sizeof(params), "lines=%d query=%d found=%d/%d", n, k, found, i);
+        result("history", params, t[2] / i, "us/query");
+        result("history", params, t[1], "us max");
+    }
+    // no match: every line is looked at without the index (query of 2), few with it
+    for (k = 2; k <= 6; k += 2)
+    {
+        snprintf(query, k + 1, "ZqZqZq");
+        start = now_us();
+        history_find(query, 0, &len);
+        snprintf(params, sizeof(params), "lines=%d query=%d absent", n, k);
+        result("history", params, now_us() - start, "us/query");
+    }
+    unsetenv("HOME");
+    free(names);
+}
+
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        void (*fn)();
+    } suites[] = {
+        {"startup", bench_startup},
+        {"complete", bench_complete},
+        {"parse", bench_parse},
+        {"pipeline", bench_pipeline},
+        {"traverse", bench_traverse},
+        {"listing", bench_listing},
+        {"history", bench_history},
+    };
+    int nsuites = sizeof(suites) / sizeof(suites[0]);
+    int i, k, chosen = 0;
+    char cmd[600];
+    sigset_t chld;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (argc > 1 && strcmp(argv[1], "-json") == 0)
+    {
+        json = 1;
+        argv++;
+        argc--;
+    }
+    if (env_ints("BENCH_RUNS", "5", &runs, 1) == -1 || runs < 1)
+        runs = 1;
+    if (env_ints("BENCH_TIMEOUT", "60", &timeout, 1) == -1 || timeout < 1)
+        timeout = 60;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, NULL);
+    if (mkdtemp(workdir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (!json)
+        printf("%-10s %-34s %14s %s\n", "suite", "params", "value", "unit");
+    for (k = 0; k < nsuites; k++)
+    {
+        for (i = 1; i < argc; i++)
+            if (strcmp(argv[i], suites[k].name) == 0)
+                break;
+        if (argc == 1 || i < argc)
+        {
+            suites[k].fn();
+            chosen++;
+        }
+    }
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", workdir);
+    system(cmd);
+    if (chosen == 0)
+    {
+        fprintf(stderr, "usage: msh_bench [-json] [startup] [complete] [parse] [pipeline] [traverse] [listing] [history]\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Throughput of a multi-stage pipeline run by msh, with the default pipe size
+# and with bigger pipes ('set pipesize').
+#
+# usage: bench/pipe_bench.sh [bytes] [stages] [pipesize ...]
+
+MSH=${MSH:-./output}
+BYTES=${1:-1073741824}
+STAGES=${2:-4}
+[ $# -gt 2 ] && shift 2 || set --
+SIZES=${*:-0 262144 1048576}
+
+line="head -c $BYTES /dev/zero"
+i=0
+while [ $i -lt $STAGES ]; do
+    line="$line | cat"
+    i=$((i + 1))
+done
+line="$line | wc -c"
+
+printf '%10s %8s %10s %10s\n' pipesize stages seconds MB/s
+for size in $SIZES; do
+    start=$(date +%s%N)
+    out=$(printf 'set pipesize %s\n%s\n' "$size" "$line" | $MSH)
+    end=$(date +%s%N)
+    if [ "$out" != "$BYTES" ]; then
+        echo "pipe_bench: pipeline moved '$out' bytes, expected $BYTES" >&2
+        exit 1
+    fi
+    awk -v s="$size" -v n="$STAGES" -v t="$((end - start))" -v b="$BYTES" \
+        'BEGIN { printf "%10d %8d %10.3f %10.1f\n", s, n, t / 1e9, b / 1048576 / (t / 1e9) }'
+done
@@ -0,0 +1,93 @@
+/*
+ * @file spawn_bench.c
+ * @brief Latency of fork+exec against posix_spawn as the RSS of the parent grows
+ *
+ * usage: spawn_bench [iterations] [rss_mb ...]
+ *
+ * for every RSS size the process touches a ballast of that size and then
+ * launches /bin/true the given number of times with each method
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static char *const args[] = {"true", NULL};
+
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/*
+ * @brief average microseconds of fork + execv + waitpid
+ */
+static double bench_fork(int iterations)
+{
+    double start = now_us();
+    int i, status;
+    pid_t pid;
+
+    for (i = 0; i < iterations; i++)
+    {
+        pid = fork();
+        if (pid == 0)
+        {
+            execv("/bin/true", args);
+            _exit(127);
+        }
+        waitpid(pid, &status, 0);
+    }
+    return (now_us() - start) / iterations;
+}
+
+/*
+ * @brief average microseconds of posix_spawn + waitpid
+ */
+static double bench_spawn(int iterations)
+{
+    double start = now_us();
+    int i, status;
+    pid_t pid;
+
+    for (i = 0; i < iterations; i++)
+    {
+        posix_spawn(&pid, "/bin/true", NULL, NULL, args, environ);
+        waitpid(pid, &status, 0);
+    }
+    return (now_us() - start) / iterations;
+}
+
+int main(int argc, char *argv[])
+{
+    int iterations = argc > 1 ? atoi(argv[1]) : 200;
+    static const int sizes[] = {0, 64, 256, 512};
+    int nsizes = argc > 2 ? argc - 2 : sizeof(sizes) / sizeof(sizes[0]);
+    char *ballast = NULL;
+    size_t current = 0;
+    int i;
+
+    printf("%8s %12s %12s\n", "rss_mb", "fork_us", "spawn_us");
+    for (i = 0; i < nsizes; i++)
+    {
+        size_t mb = argc > 2 ? (size_t)atoi(argv[i + 2]) : (size_t)sizes[i];
+        if (mb * 1024 * 1024 > current)
+        {
+            ballast = realloc(ballast, mb * 1024 * 1024);
+            memset(ballast + current, 1, mb * 1024 * 1024 - current); // touch every page
+            current = mb * 1024 * 1024;
+        }
+        printf("%8zu %12.1f %12.1f\n", mb, bench_fork(iterations), bench_spawn(iterations));
+        fflush(stdout);
+    }
+    free(ballast);
+    return 0;
+}
@@ -0,0 +1,349 @@
+/*
+ * @file builtin.c
+ * @brief Table of the builtin commands
+ *
+ * The builtins are found with a hash of the name (open addressing, filled on
+ * the first lookup). A builtin alone in the line runs inside the shell, its
+ * redirections are applied to the shell descriptors and undone afterwards.
+ * In a pipeline the builtins marked BUILTIN_THREAD run in a thread of the
+ * shell writing to the pipe (see exec_comandos), the others in a child.
+ *
+ * Every builtin writes its output to the FILE it receives, never to stdout.
+ */
+
+#include "header.h"
+
+static int builtin_cd(CMD *cmd, FILE *out);
+static int builtin_echo(CMD *cmd, FILE *out);
+static int builtin_pwd(CMD *cmd, FILE *out);
+static int builtin_true(CMD *cmd, FILE *out);
+static int builtin_false(CMD *cmd, FILE *out);
+static int builtin_exit(CMD *cmd, FILE *out);
+static int builtin_set(CMD *cmd, FILE *out);
+
+OPTIONS options = {0};
+
+static BUILTIN builtins[] = {
+    {"cd", builtin_cd, 0},
+    {"echo", builtin_echo, BUILTIN_THREAD},
+    {"pwd", builtin_pwd, BUILTIN_THREAD},
+    {"true", builtin_true, BUILTIN_THREAD},
+    {"false", builtin_false, BUILTIN_THREAD},
+    {"exit", builtin_exit, 0},
+    {"set", builtin_set, 0},
+    {"hash", hash_builtin, BUILTIN_THREAD},
+    {"myls", exec_myls, BUILTIN_THREAD},
+    {"myfind", exec_myfind, BUILTIN_THREAD},
+    {"jobs", builtin_jobs, 0},
+    {"wait", builtin_wait, 0},
+    {"fg", builtin_fg, 0},
+    {"history", builtin_history, 0},
+};
+
+static BUILTIN *slots[BUILTIN_SLOTS]; // open addressing, BUILTIN_SLOTS is a power of 2
+
+static unsigned int builtin_hash(const char *s)
+{
+    unsigned int h = 5381;
+
+    while (*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h & (BUILTIN_SLOTS - 1);
+}
+
+/*
+ * @brief find a builtin
+ * @param const char* name - argv[0]
+ * @return the builtin or NULL
+ */
+BUILTIN *builtin_lookup(const char *name)
+{
+    static int filled = 0;
+    unsigned int h;
+    int i;
+
+    if (!filled)
+    {
+        for (i = 0; i < (int)(sizeof(builtins) / sizeof(builtins[0])); i++)
+        {
+            for (h = builtin_hash(builtins[i].name); slots[h] != NULL; h = (h + 1) & (BUILTIN_SLOTS - 1))
+                ;
+            slots[h] = &builtins[i];
+        }
+        filled = 1;
+    }
+    for (h = builtin_hash(name); slots[h] != NULL; h = (h + 1) & (BUILTIN_SLOTS - 1))
+    {
+        if (strcmp(slots[h]->name, name) == 0)
+            return slots[h];
+    }
+    return NULL;
+}
+
+/*
+ * @brief open a file over one of the standard descriptors
+ * @param const char* file - file to open (nothing is done if NULL)
+ * @param int target - 0, 1 or 2
+ * @param int* saved - receives a copy of the previous descriptor
+ * @return 0 or -1 if the file could not be opened
+ */
+int redirect_fd(const char *file, int target, int *saved)
+{
+    int fp;
+
+    if (file == NULL)
+        return 0;
+    if (target == 0)
+        fp = open(file, O_RDONLY, 0400); // owner read
+    else
+        fp = open(file, O_WRONLY | O_TRUNC | O_CREAT, 0200); // owner write
+    if (fp == -1)
+    {
+        perror(target == 0 ? "File not existent" : "Error creating file");
+        return -1;
+    }
+    if (saved != NULL)
+        *saved = fcntl(target, F_DUPFD_CLOEXEC, 10);
+    dup2(fp, target);
+    close(fp);
+    return 0;
+}
+
+/*
+ * @brief run a builtin inside the shell
+ * @param BUILTIN* b - builtin
+ * @param CMD* cmd - command with its redirections
+ * @return exit status of the builtin
+ *
+ * a cd that worked is a visit for frecency.c, only here: a cd in a pipeline
+ * runs in a child (spawn_builtin) and the shell does not move; the cds of
+ * scripts are not visits
+ */
+int builtin_run(BUILTIN *b, CMD *cmd)
+{
+    int saved[3] = {-1, -1, -1};
+    int i, status = 1;
+    char cwd[PATH_MAX];
+
+    fflush(stdout);
+    fflush(stderr);
+    if (redirect_fd(cmd->infile, 0, &saved[0]) == 0 &&
+        redirect_fd(cmd->outfile, 1, &saved[1]) == 0 &&
+        redirect_fd(cmd->errfile, 2, &saved[2]) == 0)
+    {
+        status = b->fn(cmd, stdout);
+    }
+    if (b->fn == builtin_cd && status == 0 && interactive && getcwd(cwd, sizeof(cwd)) != NULL)
+        frecency_add(cwd);
+    fflush(stdout);
+    fflush(stderr);
+    for (i = 0; i < 3; i++)
+    {
+        if (saved[i] != -1)
+        {
+            dup2(saved[i], i);
+            close(saved[i]);
+        }
+    }
+    return status;
+}
+
+/*
+ * @brief cd [dir | word...] - without destination goes to $HOME (or /)
+ *
+ * words that are not a directory are looked up among the directories cd
+ * went to (see frecency.c), the one chosen is printed
+ */
+static int builtin_cd(CMD *cmd, FILE *out)
+{
+    const char *dir = cmd->argv[1], *home = getenv("HOME");
+    int r = -1, err = 0;
+
+    if (dir == NULL)
+        dir = home != NULL && *home ? home : "/";
+    if (cmd->argv[1] == NULL || cmd->argv[2] == NULL)
+    {
+        r = chdir(dir);
+        err = errno;
+    }
+    if (r == -1 && cmd->argv[1] != NULL && (cmd->argv[2] != NULL || err == ENOENT) &&
+        (dir = frecency_match(cmd->argv + 1)) != NULL)
+    {
+        fprintf(out, "%s\n", dir);
+        r = chdir(dir);
+        err = errno;
+    }
+    if (r == -1)
+    {
+        fprintf(stderr, "cd: %s: %s\n", cmd->argv[1] ? cmd->argv[1] : dir, err ? strerror(err) : "no such directory");
+        return 1;
+    }
+    update_path();
+    return 0;
+}
+
+/*
+ * @brief echo [-n] [args]
+ */
+static int builtin_echo(CMD *cmd, FILE *out)
+{
+    int i = 1, newline = 1;
+
+    if (cmd->argv[1] != NULL && strcmp(cmd->argv[1], "-n") == 0)
+    {
+        newline = 0;
+        i++;
+    }
+    for (; cmd->argv[i] != NULL; i++)
+    {
+        fputs(cmd->argv[i], out);
+        if (cmd->argv[i + 1] != NULL)
+            putc(' ', out);
+    }
+    if (newline)
+        putc('\n', out);
+    return 0;
+}
+
+static int builtin_pwd(CMD *cmd, FILE *out)
+{
+    char pwd[2048];
+
+    if (getcwd(pwd, sizeof(pwd)) == NULL)
+    {
+        perror("pwd");
+        return 1;
+    }
+    fprintf(out, "%s\n", pwd);
+    return 0;
+}
+
+static int builtin_true(CMD *cmd, FILE *out)
+{
+    return 0;
+}
+
+static int builtin_false(CMD *cmd, FILE *out)
+{
+    return 1;
+}
+
+/*
+ * @brief exit [n] - without n exits with the status of the last line
+ */
+static int builtin_exit(CMD *cmd, FILE *out)
+{
+    fflush(stdout);
+    exit(cmd->argv[1] ? atoi(cmd->argv[1]) : last_status);
+}
+
+/*
+ * @brief set [option value] - print or change the shell options
+ *
+ * pipesize N - size in bytes of the pipes of a pipeline (F_SETPIPE_SZ), 0 for the default
+ * timing on|off - time every pipeline, as with the time prefix
+ * timelog FILE - also append the timings to FILE as JSON lines (- to stop)
+ */
+static int builtin_set(CMD *cmd, FILE *out)
+{
+    int fds[2], size;
+
+    if (cmd->argv[1] == NULL)
+    {
+        fprintf(out, "pipesize %d\n", options.pipesize);
+        fprintf(out, "timing %s\n", options.timing ? "on" : "off");
+        fprintf(out, "timelog %s\n", options.timelog ? options.timelog : "-");
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "timing") == 0 && cmd->argv[2] != NULL)
+    {
+        options.timing = strcmp(cmd->argv[2], "on") == 0;
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "timelog") == 0 && cmd->argv[2] != NULL)
+    {
+        free(options.timelog);
+        options.timelog = strcmp(cmd->argv[2], "-") == 0 ? NULL : strdup(cmd->argv[2]);
+        return 0;
+    }
+    if (strcmp(cmd->argv[1], "pipesize") == 0 && cmd->argv[2] != NULL)
+    {
+        size = atoi(cmd->argv[2]);
+        // try it once here instead of failing on every pipeline
+        if (size > 0 && pipe(fds) == 0)
+        {
+            int r = fcntl(fds[1], F_SETPIPE_SZ, size);
+            close(fds[0]);
+            close(fds[1]);
+            if (r == -1)
+            {
+                perror("set pipesize");
+                return 1;
+            }
+        }
+        options.pipesize = size > 0 ? size : 0;
+        return 0;
+    }
+    fprintf(stderr, "set: usage: set [pipesize N | timing on|off | timelog FILE|-]\n");
+    return 1;
+}
+
+/*
+ * @brief thread of a builtin stage of a pipeline
+ * @param void* arg - STAGE with the builtin, the command and its output
+ */
+static void *stage_thread(void *arg)
+{
+    STAGE *st = arg;
+    struct rusage before;
+
+    if (st->time != NULL)
+        getrusage(RUSAGE_THREAD, &before);
+    timing_stage = st->time; // the pools of the builtin add their workers to it
+    st->status = st->b->fn(st->cmd, st->out);
+    if (st->out == stdout)
+        fflush(stdout);
+    else
+        fclose(st->out); // the reader of the pipe gets EOF
+    if (st->time != NULL)
+    {
+        timing_usage(st->time, &before);
+        timing_end(st->time, st->status);
+    }
+    return NULL;
+}
+
+/*
+ * @brief run a builtin as a stage of a pipeline in a thread of the shell
+ * @param STAGE* st - stage, st->b and st->cmd set
+ * @param int in - pipe to read or -1 (builtins do not read, it is closed)
+ * @param int out - pipe to write or -1 for stdout
+ * @return 0 or -1 if the outfile could not be created
+ *
+ * the thread owns out and closes it when the builtin returns; join with
+ * pthread_join(st->tid) and read st->status
+ */
+int stage_start(STAGE *st, int in, int out)
+{
+    int fp;
+
+    if (in != -1)
+        close(in);
+    if (st->cmd->outfile != NULL)
+    {
+        fp = open(st->cmd->outfile, O_WRONLY | O_TRUNC | O_CREAT | O_CLOEXEC, 0200); // owner write
+        if (fp == -1)
+        {
+            perror("Error creating file");
+            if (out != -1)
+                close(out);
+            return -1;
+        }
+        if (out != -1)
+            close(out); // the next stage reads nothing, like with a child
+        out = fp;
+    }
+    st->out = out == -1 ? stdout : fdopen(out, "w");
+    pthread_create(&st->tid, NULL, stage_thread, st);
+    return 0;
+}
@@ -0,0 +1,235 @@
+/*
+ * @file cache.c
+ * @brief On-disk cache of the executables found in $PATH
+ *
+ * The cache file ($HOME/.msh_cache) keeps, for every $PATH directory, its
+ * mtime and the names of the executables it held. At startup the file is
+ * memory-mapped and every directory whose mtime did not change is taken from
+ * the mapping, so only the changed directories are scanned again with stat().
+ *
+ * Layout (native endianness, records aligned to 8 bytes):
+ *   CACHEHDR
+ *   CACHEREC, path\0, name\0name\0...   (one per directory)
+ */
+
+#include "header.h"
+
+typedef struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ndirs;
+    uint32_t pad;
+} CACHEHDR;
+
+typedef struct cache_record {
+    uint32_t pathlen; // including the '\0'
+    uint32_t count;   // number of names
+    uint32_t bloblen; // bytes used by the names
+    uint32_t pad;
+    int64_t sec;      // mtime of the directory
+    int64_t nsec;
+} CACHEREC;
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+static char *map = NULL; // kept for the whole session, names point into it
+static size_t map_size = 0;
+static int dirty = 0;    // something was rescanned, the file must be rewritten
+
+/*
+ * @brief build the cache file name
+ * @return malloc'd path or NULL when there is no $HOME
+ */
+static char *cache_path()
+{
+    char *home = getenv("HOME");
+    char *file;
+
+    if (home == NULL)
+        return NULL;
+    file = malloc(strlen(home) + strlen(CACHE_FILE) + 2);
+    strcpy(file, home);
+    strcat(file, "/");
+    strcat(file, CACHE_FILE);
+    return file;
+}
+
+/*
+ * @brief map the cache file in memory
+ * @return 0 if a valid cache is mapped
+ */
+static int cache_map()
+{
+    char *file = cache_path();
+    struct stat sb;
+    int fd;
+
+    if (file == NULL)
+        return -1;
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    free(file);
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(CACHEHDR))
+    {
+        close(fd);
+        return -1;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        map = NULL;
+        return -1;
+    }
+    map_size = sb.st_size;
+
+    CACHEHDR *hdr = (CACHEHDR *)map;
+    if (hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION)
+    {
+        munmap(map, map_size);
+        map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * @brief look for a directory in the mapped cache and fill its entry
+ * @param DIRINDEX* d - directory to fill, d->path and d->mtime already set
+ * @return 1 if the cache had the directory with the same mtime
+ */
+static int cache_lookup(DIRINDEX *d)
+{
+    CACHEHDR *hdr = (CACHEHDR *)map;
+    size_t off = sizeof(CACHEHDR);
+    uint32_t r;
+
+    for (r = 0; r < hdr->ndirs; r++)
+    {
+        if (off + sizeof(CACHEREC) > map_size)
+            return 0;
+        CACHEREC *rec = (CACHEREC *)(map + off);
+        char *p = map + off + sizeof(CACHEREC);
+        size_t next = ALIGN8(off + sizeof(CACHEREC) + rec->pathlen + rec->bloblen);
+
+        if (next > map_size || rec->pathlen == 0 || p[rec->pathlen - 1] != '\0')
+            return 0; // truncated or corrupted file
+        if (strcmp(p, d->path) == 0)
+        {
+            if (rec->sec != d->mtime.tv_sec || rec->nsec != d->mtime.tv_nsec)
+                return 0;
+
+            char *name = p + rec->pathlen;
+            char *end = name + rec->bloblen;
+            uint32_t i;
+
+            if (rec->bloblen && end[-1] != '\0')
+                return 0;
+            d->names = malloc((rec->count + 1) * sizeof(char *));
+            for (i = 0; i < rec->count && name < end; i++)
+            {
+                d->names[i] = name;
+                name += strlen(name) + 1;
+            }
+            d->names[i] = NULL;
+            d->n = i;
+            return 1;
+        }
+        off = next;
+    }
+    return 0;
+}
+
+/*
+ * @brief stat every $PATH directory and take the unchanged ones from the cache
+ * @param int n - number of directories
+ *
+ * directories not found (or changed) are marked stale, to be read by insert_directories()
+ */
+void cache_load(int n)
+{
+    struct stat sb;
+    int i, mapped = cache_map() == 0;
+
+    for (i = 0; i < n; i++)
+    {
+        DIRINDEX *d = &dir_index[i];
+        d->path = directories[i];
+        if (stat(d->path, &sb) == -1)
+        {
+            d->missing = 1;
+            continue;
+        }
+        d->mtime = sb.st_mtim;
+        if (!mapped || !cache_lookup(d))
+        {
+            d->stale = 1;
+            dirty = 1;
+        }
+    }
+}
+
+/*
+ * @brief write the cache file again if any directory was rescanned
+ * @param int n - number of directories
+ *
+ * the new file is written aside and renamed, so a concurrent shell
+ * mapping the old one is not affected
+ */
+void cache_save(int n)
+{
+    char *file, *tmp;
+    FILE *fp;
+    CACHEHDR hdr = {CACHE_MAGIC, CACHE_VERSION, 0, 0};
+    static const char zeros[8] = {0};
+    int i, j;
+
+    if (!dirty || (file = cache_path()) == NULL)
+        return;
+    tmp = malloc(strlen(file) + 32);
+    sprintf(tmp, "%s.%d", file, (int)getpid());
+    if ((fp = fopen(tmp, "w")) == NULL)
+    {
+        free(tmp);
+        free(file);
+        return;
+    }
+
+    for (i = 0; i < n; i++)
+        if (!dir_index[i].missing)
+            hdr.ndirs++;
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+
+    for (i = 0; i < n; i++)
+    {
+        DIRINDEX *d = &dir_index[i];
+        CACHEREC rec = {0};
+        size_t len;
+
+        if (d->missing)
+            continue;
+        rec.pathlen = strlen(d->path) + 1;
+        rec.count = d->n;
+        for (j = 0; j < d->n; j++)
+            rec.bloblen += strlen(d->names[j]) + 1;
+        rec.sec = d->mtime.tv_sec;
+        rec.nsec = d->mtime.tv_nsec;
+
+        fwrite(&rec, sizeof(rec), 1, fp);
+        fwrite(d->path, 1, rec.pathlen, fp);
+        for (j = 0; j < d->n; j++)
+            fwrite(d->names[j], 1, strlen(d->names[j]) + 1, fp);
+        len = sizeof(rec) + rec.pathlen + rec.bloblen;
+        fwrite(zeros, 1, ALIGN8(len) - len, fp);
+    }
+
+    int err = ferror(fp);
+    if (fclose(fp) == 0 && !err)
+        rename(tmp, file);
+    else
+        unlink(tmp);
+    dirty = 0;
+    free(tmp);
+    free(file);
+}
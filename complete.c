@@ -0,0 +1,570 @@
+/*
+ * @file complete.c
+ * @brief Index of the executables in $PATH and tab completion
+ *
+ * dictionary is kept sorted and without duplicates, so the names starting
+ * with a prefix are a contiguous range found with a binary search
+ *
+ * the index is built by a background thread (index_path) while the prompt is
+ * already shown; completion uses whatever is indexed at the time. Afterwards
+ * the same thread watches the $PATH directories with inotify and keeps the
+ * dictionary up to date when programs are installed or removed.
+ *
+ * TAB completes the executables in command position (start of the line,
+ * after | or & and after time), the directories after cd and the file names
+ * everywhere else (arguments, after < > 2>). The listings of the last
+ * COMPLETE_DIRS directories are kept sorted, known by device and inode, and
+ * read again only when the mtime of the directory changed: a TAB in a big
+ * directory costs one stat() and a binary search.
+ */
+
+#include "header.h"
+
+/* entry of a directory listing */
+typedef struct listing_entry {
+    char *name;
+    int isdir;
+} LISTENTRY;
+
+/* sorted entries of a directory, as read at mtime */
+typedef struct listing {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    LISTENTRY *entries;
+    int n;
+    unsigned long used; // for the replacement of the least recently used
+} LISTING;
+
+pthread_mutex_t dict_mutex = PTHREAD_MUTEX_INITIALIZER;
+char **dictionary = NULL;  // store executable programs from directories (sorted, NULL terminated)
+static int incremento_dicionario = 0;
+static int ndirectories = 0;
+static LISTING listings[COMPLETE_DIRS];
+static unsigned long listing_clock = 0;
+long listing_reads = 0; // directories read for completion, for bench/msh_bench
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * @brief merge names into the dictionary
+ * @param char** names - executables of one directory (not copied)
+ * @param int n - number of names
+ *
+ * the names are sorted apart and merged with the dictionary, dropping duplicates
+ */
+void index_add(char **names, int n)
+{
+    char **batch, **merged, *next;
+    int i = 0, j = 0, k = 0;
+
+    if (n <= 0)
+        return;
+    batch = malloc(n * sizeof(char *));
+    memcpy(batch, names, n * sizeof(char *));
+    qsort(batch, n, sizeof(char *), compare_names);
+
+    // CRITICAL AREA
+    pthread_mutex_lock(&dict_mutex);
+    merged = malloc((incremento_dicionario + n + 1) * sizeof(char *));
+    while (i < incremento_dicionario || j < n)
+    {
+        if (j == n || (i < incremento_dicionario && strcmp(dictionary[i], batch[j]) <= 0))
+            next = dictionary[i++];
+        else
+            next = batch[j++];
+        if (k == 0 || strcmp(merged[k - 1], next) != 0)
+            merged[k++] = next;
+    }
+    merged[k] = NULL;
+    free(dictionary);
+    dictionary = merged;
+    incremento_dicionario = k;
+    pthread_mutex_unlock(&dict_mutex);
+    // END OF CRITICAL AREA
+
+    free(batch);
+}
+
+/*
+ * @brief remove a name from the dictionary
+ * @param const char* name - executable no longer found in $PATH
+ *
+ * the string itself is not freed, it belongs to dir_index (or to the cache mapping)
+ */
+void index_remove(const char *name)
+{
+    int i;
+
+    // CRITICAL AREA
+    pthread_mutex_lock(&dict_mutex);
+    i = index_lower_bound(name, strlen(name) + 1);
+    if (i < incremento_dicionario && strcmp(dictionary[i], name) == 0)
+    {
+        memmove(dictionary + i, dictionary + i + 1, (incremento_dicionario - i) * sizeof(char *));
+        incremento_dicionario--;
+    }
+    pthread_mutex_unlock(&dict_mutex);
+    // END OF CRITICAL AREA
+}
+
+/*
+ * @brief first position of the dictionary not smaller than the prefix
+ * @param const char* text - prefix
+ * @param int len - length of the prefix
+ * @return position of the first name with the prefix (if there is one)
+ *
+ * must be called with dict_mutex held
+ */
+int index_lower_bound(const char *text, int len)
+{
+    int lo = 0, hi = incremento_dicionario, mid;
+
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (strncmp(dictionary[mid], text, len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * @brief store directories
+ * @param void* pos - position in directories to use
+ *
+ * the names are also kept in dir_index[pos] to be written to the cache
+ */
+void *insert_directories(void *pos)
+{
+    int i = *((int *)pos);
+    DIRINDEX *d = &dir_index[i];
+    DIRREAD dir;
+    struct dirent64 *entry;
+    struct stat sb;
+
+    if (dir_open(&dir, AT_FDCWD, directories[i]) == -1)
+        perror("opendir() error");
+    else
+    {
+        while ((entry = dir_next(&dir)) != NULL)
+        {
+            int ponto = strcmp(entry->d_name, ".");
+            int ponto2 = strcmp(entry->d_name, "..");
+
+            // relative to the directory, no path to build (stat follows the links)
+            if (ponto2 != 0 && ponto != 0 && fstatat(dir.fd, entry->d_name, &sb, 0) == 0 && sb.st_mode & S_IXUSR)
+            {
+                d->names = realloc(d->names, (d->n + 2) * sizeof(char *));
+                d->names[d->n++] = strdup(entry->d_name);
+                d->names[d->n] = NULL;
+            }
+        }
+        dir_close(&dir);
+    }
+    index_add(d->names, d->n);
+    return NULL;
+}
+
+/*
+ * @brief fill the dictionary with the executables of every $PATH directory
+ * @param int size - number of directories
+ *
+ * only the directories changed since the last run are read again
+ */
+void index_build(int size)
+{
+    pthread_t tid[size];
+    int index[size], i;
+
+    cache_load(size);
+    for (i = 0; i < size; i++)
+    {
+        index[i] = i;
+        if (dir_index[i].stale)
+            pthread_create(&tid[i], NULL, &insert_directories, &index[i]);
+        else
+            index_add(dir_index[i].names, dir_index[i].n);
+    }
+    for (i = 0; i < size; i++)
+    {
+        if (dir_index[i].stale)
+            pthread_join(tid[i], NULL);
+    }
+    cache_save(size);
+}
+
+/*
+ * @brief check if a name is an executable of the directory
+ * @return 1 if directory/name exists and has S_IXUSR
+ */
+static int is_executable(const char *directory, const char *name)
+{
+    char *result = malloc(strlen(directory) + strlen(name) + 2);
+    struct stat sb;
+    int x;
+
+    strcpy(result, directory);
+    strcat(result, "/");
+    strcat(result, name);
+    x = stat(result, &sb) == 0 && (sb.st_mode & S_IXUSR);
+    free(result);
+    return x;
+}
+
+/*
+ * @brief apply one inotify event to the dictionary
+ * @param int i - directory of the event
+ * @param struct inotify_event* ev - event
+ *
+ * a name is only removed when no other $PATH directory still provides it
+ */
+static void watch_event(int i, struct inotify_event *ev)
+{
+    int j, known;
+
+    if (ev->len == 0 || ev->name[0] == '.')
+        return;
+    hash_remove(ev->name); // resolved again on the next use
+    if (!(ev->mask & (IN_DELETE | IN_MOVED_FROM)) && is_executable(directories[i], ev->name))
+    {
+        // index_add() drops a name already there without freeing it, no copy for it
+        pthread_mutex_lock(&dict_mutex);
+        j = index_lower_bound(ev->name, strlen(ev->name) + 1);
+        known = j < incremento_dicionario && strcmp(dictionary[j], ev->name) == 0;
+        pthread_mutex_unlock(&dict_mutex);
+        if (!known)
+        {
+            char *name = strdup(ev->name);
+            index_add(&name, 1);
+        }
+        return;
+    }
+    for (j = 0; j < ndirectories; j++)
+    {
+        if (!dir_index[j].missing && is_executable(directories[j], ev->name))
+            return;
+    }
+    index_remove(ev->name);
+}
+
+/*
+ * @brief read inotify events forever
+ * @param int fd - inotify descriptor
+ * @param int* wd - watch descriptor of every directory
+ */
+static void watch_directories(int fd, int *wd)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    char *ptr;
+    int i;
+
+    while ((len = read(fd, buf, sizeof(buf))) > 0 || (len == -1 && errno == EINTR))
+    {
+        for (ptr = buf; len > 0 && ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len)
+        {
+            struct inotify_event *ev = (struct inotify_event *)ptr;
+            for (i = 0; i < ndirectories; i++)
+            {
+                if (wd[i] == ev->wd)
+                    watch_event(i, ev);
+            }
+        }
+    }
+}
+
+/*
+ * @brief build the index of executables and keep it updated (background thread)
+ * @param void* n - number of directories in $PATH
+ *
+ * - watch every directory (before reading, so nothing is lost)
+ * - take the unchanged directories from the cache and read the others
+ * - save the cache and wait for inotify events
+ */
+void *index_path(void *n)
+{
+    int size = (int)(intptr_t)n;
+    int wd[size], i, fd;
+
+    ndirectories = size;
+    fd = inotify_init1(IN_CLOEXEC);
+    for (i = 0; i < size; i++)
+    {
+        wd[i] = -1;
+        if (fd != -1)
+            wd[i] = inotify_add_watch(fd, directories[i], IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | IN_CLOSE_WRITE);
+    }
+
+    index_build(size);
+
+    if (fd != -1)
+    {
+        watch_directories(fd, wd);
+        close(fd);
+    }
+    return NULL;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    return strcmp(((const LISTENTRY *)a)->name, ((const LISTENTRY *)b)->name);
+}
+
+/*
+ * @brief read a directory into l, sorted by name
+ */
+static void listing_read(LISTING *l, const char *dir)
+{
+    struct dirent64 *entry;
+    struct stat sb;
+    DIRREAD d;
+    int i, cap = 0;
+
+    for (i = 0; i < l->n; i++)
+        free(l->entries[i].name);
+    free(l->entries);
+    l->entries = NULL;
+    l->n = 0;
+    listing_reads++;
+    if (dir_open(&d, AT_FDCWD, dir) == -1)
+        return;
+    while ((entry = dir_next(&d)) != NULL)
+    {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+            continue;
+        if (l->n == cap)
+            l->entries = realloc(l->entries, (cap = cap ? cap * 2 : 64) * sizeof(LISTENTRY));
+        l->entries[l->n].name = strdup(entry->d_name);
+        l->entries[l->n].isdir = entry->d_type == DT_DIR;
+        // a link to a directory is completed as a directory, cd follows it
+        if ((entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) && fstatat(d.fd, entry->d_name, &sb, 0) == 0)
+            l->entries[l->n].isdir = S_ISDIR(sb.st_mode);
+        l->n++;
+    }
+    dir_close(&d);
+    qsort(l->entries, l->n, sizeof(LISTENTRY), compare_entries);
+}
+
+/*
+ * @brief listing of a directory, read again only when its mtime changed
+ * @return the listing or NULL if the directory cannot be read
+ */
+static LISTING *listing_get(const char *dir)
+{
+    LISTING *l = NULL;
+    struct stat sb;
+    int i;
+
+    if (stat(dir, &sb) == -1 || !S_ISDIR(sb.st_mode))
+        return NULL;
+    for (i = 0; i < COMPLETE_DIRS; i++)
+    {
+        if (listings[i].used && listings[i].dev == sb.st_dev && listings[i].ino == sb.st_ino)
+        {
+            l = &listings[i];
+            break;
+        }
+        if (l == NULL || listings[i].used < l->used)
+            l = &listings[i];
+    }
+    if (i == COMPLETE_DIRS || l->mtime.tv_sec != sb.st_mtim.tv_sec || l->mtime.tv_nsec != sb.st_mtim.tv_nsec)
+    {
+        l->dev = sb.st_dev;
+        l->ino = sb.st_ino;
+        l->mtime = sb.st_mtim;
+        listing_read(l, dir);
+    }
+    l->used = ++listing_clock;
+    return l;
+}
+
+/*
+ * @brief matches of text in the directory part of text
+ * @param int dirs - only the directories
+ * @return NULL terminated array of malloc'd paths, for rl_completion_matches()
+ *
+ * text keeps the directory part as typed (~ included), the names starting
+ * with '.' are only offered when the name part starts with '.'
+ */
+static char **file_matches(const char *text, int dirs)
+{
+    const char *slash = strrchr(text, '/'), *base = slash ? slash + 1 : text;
+    int dlen = slash ? slash - text + 1 : 0, blen = strlen(base), lo = 0, hi, n = 0, mid;
+    char *dir, **matches;
+    LISTING *l;
+
+    if (dlen == 0)
+        dir = strdup(".");
+    else
+    {
+        char *typed = strndup(text, dlen);
+        dir = tilde_expand(typed);
+        free(typed);
+    }
+    l = listing_get(dir);
+    free(dir);
+    if (l == NULL)
+        return NULL;
+
+    // the names with the prefix are contiguous
+    hi = l->n;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo) / 2;
+        if (strncmp(l->entries[mid].name, base, blen) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    matches = malloc((l->n - lo + 1) * sizeof(char *));
+    for (; lo < l->n && strncmp(l->entries[lo].name, base, blen) == 0; lo++)
+    {
+        LISTENTRY *e = &l->entries[lo];
+        if ((dirs && !e->isdir) || (e->name[0] == '.' && base[0] != '.'))
+            continue;
+        matches[n] = malloc(dlen + strlen(e->name) + 1);
+        memcpy(matches[n], text, dlen);
+        strcpy(matches[n++] + dlen, e->name);
+    }
+    matches[n] = NULL;
+    return matches;
+}
+
+/*
+ * @brief generator of file names for rl_completion_matches()
+ */
+char *file_name_generator(const char *text, int state)
+{
+    static char **matches = NULL;
+    static int list_index;
+
+    if (!state)
+    {
+        free(matches); // the strings were given to readline
+        matches = file_matches(text, 0);
+        list_index = 0;
+    }
+    return matches && matches[list_index] ? matches[list_index++] : NULL;
+}
+
+/*
+ * @brief generator of directory names for rl_completion_matches()
+ */
+char *directory_name_generator(const char *text, int state)
+{
+    static char **matches = NULL;
+    static int list_index;
+
+    if (!state)
+    {
+        free(matches);
+        matches = file_matches(text, 1);
+        list_index = 0;
+    }
+    return matches && matches[list_index] ? matches[list_index++] : NULL;
+}
+
+/*
+ * @brief what the word at start is: COMPLETE_COMMAND, COMPLETE_DIRECTORY or COMPLETE_FILE
+ * @param const char* line - line being edited
+ * @param int start - offset of the word in the line
+ *
+ * the line before the word is split by the lexer: a word right after a
+ * redirection is a file; the first word after the start, | or & (time put
+ * aside) is the command; the arguments of cd are directories
+ */
+int completion_context(const char *line, int start)
+{
+    char *before = strndup(line, start);
+    TOKEN *tokens = malloc((start + 1) * sizeof(TOKEN));
+    int n, i, words = 0, cd = 0, redirect = 0, context;
+
+    // the word may start after an opening quote
+    if ((n = lex_line(before, tokens)) == -1 && start > 0)
+    {
+        before[start - 1] = '\0';
+        n = lex_line(before, tokens);
+    }
+    for (i = 0; i < n; i++)
+    {
+        TOKEN *t = &tokens[i];
+        if (t->type == TOK_PIPE || t->type == TOK_AMP)
+            words = cd = redirect = 0;
+        else if (t->type != TOK_WORD)
+            redirect = 1;
+        else if (redirect)
+            redirect = 0; // the file of the redirection
+        else if (words == 0 && t->len == 4 && strncmp(before + t->off, "time", 4) == 0)
+            continue;     // the command comes after
+        else if (words++ == 0)
+            cd = t->len == 2 && strncmp(before + t->off, "cd", 2) == 0;
+    }
+    if (n == -1 || redirect)
+        context = COMPLETE_FILE;
+    else if (words == 0)
+        context = COMPLETE_COMMAND;
+    else
+        context = cd ? COMPLETE_DIRECTORY : COMPLETE_FILE;
+    free(tokens);
+    free(before);
+    return context;
+}
+
+/*
+ * @brief Point 3
+ * See second link
+ */
+char **
+character_name_completion(const char *text, int start, int end)
+{
+    int context = completion_context(rl_line_buffer, start);
+
+    rl_attempted_completion_over = 1;
+    if (context == COMPLETE_COMMAND && strchr(text, '/') == NULL)
+        return rl_completion_matches(text, character_name_generator);
+    // readline adds the '/' of a directory and quotes the blanks
+    rl_filename_completion_desired = 1;
+    return rl_completion_matches(text, context == COMPLETE_DIRECTORY ? directory_name_generator : file_name_generator);
+}
+
+/*
+ * @brief Point 3
+ * See second link
+ */
+char *
+character_name_generator(const char *text, int state)
+{
+    static char **matches = NULL;
+    static int list_index, n, cap = 0;
+    int i, len;
+
+    // the dictionary may change in background, the matches are copied at once
+    if (!state)
+    {
+        len = strlen(text);
+        list_index = n = 0;
+        pthread_mutex_lock(&dict_mutex);
+        // the matches are contiguous, stop at the first name without the prefix
+        for (i = index_lower_bound(text, len); i < incremento_dicionario && strncmp(dictionary[i], text, len) == 0; i++)
+        {
+            if (n == cap)
+            {
+                cap = cap ? cap * 2 : 64;
+                matches = realloc(matches, cap * sizeof(char *));
+            }
+            matches[n++] = dictionary[i];
+        }
+        pthread_mutex_unlock(&dict_mutex);
+    }
+
+    if (list_index < n)
+        return strdup(matches[list_index++]);
+
+    return NULL;
+}
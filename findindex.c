@@ -0,0 +1,566 @@
+/*
+ * @file findindex.c
+ * @brief On-disk name database of a tree for myfind --index / --locate
+ *
+ * myfind --index ROOT walks ROOT once and writes, for every directory, its
+ * mtime and the names and types of its entries to
+ * $HOME/.msh_findindex.<hash of the real path of ROOT>. myfind --locate
+ * maps that file and answers from it without opening the tree.
+ *
+ * Running --index again is a refresh: every directory of the tree is still
+ * stat'ed (a change deep down does not touch the mtime of the parents), but
+ * only the ones whose mtime differs from the database are read again, the
+ * entries of the others are copied from the old file.
+ *
+ * Layout (native endianness, records aligned to 8 bytes):
+ *   IDXHDR, root\0
+ *   IDXREC, shared:u16 path-suffix\0, count x (shared:u8 type:u8 name-suffix\0)
+ *
+ * The records are in pre-order, the entries of a record sorted by name.
+ * Paths are relative to the root ("" for the root) and front-coded against
+ * the path of the previous record, names against the previous name of the
+ * same record: shared is the length of the prefix taken from it.
+ */
+
+#include "header.h"
+
+typedef struct idx_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ndirs;
+    uint32_t rootlen; // including the '\0'
+    uint64_t nentries;
+} IDXHDR;
+
+typedef struct idx_record {
+    int64_t sec;   // mtime of the directory
+    int64_t nsec;
+    uint32_t count; // entries
+    uint32_t size;  // bytes of the coded path and entries after the record
+} IDXREC;
+
+/* a directory of the database being built, entries as type, name\0 */
+typedef struct idx_dir {
+    char *path;
+    struct timespec mtime;
+    uint32_t count;
+    size_t len;
+    char *blob;
+} IDXDIR;
+
+/* directory of the old database, for the refresh */
+typedef struct idx_old {
+    char *path;
+    const char *rec;
+} IDXOLD;
+
+typedef struct idx_build {
+    char full[PATH_MAX]; // root/path of the directory being read
+    size_t rootlen;
+    IDXDIR *dirs;
+    int ndirs, cap;
+    IDXOLD *old;
+    int nold;
+    long reread;
+    uint64_t nentries;
+} IDXBUILD;
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+
+/*
+ * @brief database file of a root
+ * @param const char* real - real path of the root
+ * @return malloc'd path or NULL when there is no $HOME
+ */
+static char *index_file(const char *real)
+{
+    char *home = getenv("HOME"), *file;
+    uint64_t h = 1469598103934665603ULL; // FNV-1a
+
+    if (home == NULL)
+        return NULL;
+    for (; *real; real++)
+        h = (h ^ (unsigned char)*real) * 1099511628211ULL;
+    file = malloc(strlen(home) + strlen(FINDINDEX_FILE) + 20);
+    sprintf(file, "%s/%s.%016llx", home, FINDINDEX_FILE, (unsigned long long)h);
+    return file;
+}
+
+/*
+ * @brief map the database of a root
+ * @param size_t* size - set to the size of the mapping
+ * @return the mapping, or NULL when there is no valid database for real
+ */
+static char *index_map(const char *real, size_t *size)
+{
+    char *file = index_file(real), *map;
+    struct stat sb;
+    IDXHDR *hdr;
+    int fd;
+
+    if (file == NULL)
+        return NULL;
+    fd = open(file, O_RDONLY | O_CLOEXEC);
+    free(file);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(IDXHDR))
+    {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+    *size = sb.st_size;
+    hdr = (IDXHDR *)map;
+    if (hdr->magic != FINDINDEX_MAGIC || hdr->version != FINDINDEX_VERSION ||
+        sizeof(IDXHDR) + hdr->rootlen > *size || map[sizeof(IDXHDR) + hdr->rootlen - 1] != '\0' ||
+        strcmp(map + sizeof(IDXHDR), real) != 0) // another root with the same hash
+    {
+        munmap(map, *size);
+        return NULL;
+    }
+    madvise(map, *size, MADV_SEQUENTIAL);
+    return map;
+}
+
+static size_t index_first(char *map)
+{
+    return ALIGN8(sizeof(IDXHDR) + ((IDXHDR *)map)->rootlen);
+}
+
+/*
+ * @brief decode the record at off
+ * @param char* path - path of the previous record, replaced by this one
+ * @param const char** entries - set to the coded entries
+ * @param const char** end - set to the end of the entries
+ * @return offset of the next record, 0 if the file is corrupted
+ */
+static size_t index_record(char *map, size_t size, size_t off, char *path, IDXREC **rec,
+                           const char **entries, const char **end)
+{
+    const char *p, *stop;
+    uint16_t shared;
+    size_t n;
+
+    if (off + sizeof(IDXREC) > size)
+        return 0;
+    *rec = (IDXREC *)(map + off);
+    p = map + off + sizeof(IDXREC);
+    if ((*rec)->size > size - off - sizeof(IDXREC))
+        return 0;
+    *end = p + (*rec)->size;
+    memcpy(&shared, p, sizeof(shared));
+    p += sizeof(shared);
+    if (shared > strlen(path) || (stop = memchr(p, '\0', *end - p)) == NULL || shared + (stop - p) >= PATH_MAX)
+        return 0;
+    n = stop - p;
+    memcpy(path + shared, p, n + 1);
+    *entries = stop + 1;
+    return ALIGN8(off + sizeof(IDXREC) + (*rec)->size);
+}
+
+/*
+ * @brief decode the next entry of a record
+ * @param char* name - previous name of the record, replaced by this one
+ * @return pointer past the entry, NULL at the end or if it is corrupted
+ */
+static const char *index_entry(const char *p, const char *end, char *name, unsigned char *type)
+{
+    const char *stop;
+    unsigned char shared;
+
+    if (end - p < 3)
+        return NULL;
+    shared = p[0];
+    *type = p[1];
+    p += 2;
+    if (shared > strlen(name) || (stop = memchr(p, '\0', end - p)) == NULL || shared + (stop - p) > 255)
+        return NULL;
+    memcpy(name + shared, p, stop - p + 1);
+    return stop + 1;
+}
+
+static int compare_old(const void *a, const void *b)
+{
+    return strcmp(((const IDXOLD *)a)->path, ((const IDXOLD *)b)->path);
+}
+
+/*
+ * @brief list the directories of the old database, sorted by path
+ */
+static void index_load_old(IDXBUILD *b, char *map, size_t size)
+{
+    IDXHDR *hdr = (IDXHDR *)map;
+    char path[PATH_MAX] = "";
+    const char *entries, *end;
+    size_t off = index_first(map), next;
+    IDXREC *rec;
+    uint32_t i;
+
+    b->old = malloc(hdr->ndirs * sizeof(IDXOLD));
+    for (i = 0; i < hdr->ndirs; i++)
+    {
+        if ((next = index_record(map, size, off, path, &rec, &entries, &end)) == 0)
+            break; // the records read so far are fine
+        b->old[b->nold].path = strdup(path);
+        b->old[b->nold++].rec = map + off;
+        off = next;
+    }
+    qsort(b->old, b->nold, sizeof(IDXOLD), compare_old);
+}
+
+/*
+ * @brief entries of a directory as they were in the old database
+ * @return 1 if the directory was there with the same mtime (d filled)
+ */
+static int index_reuse(IDXBUILD *b, char *map, size_t size, IDXDIR *d)
+{
+    IDXOLD key = {d->path, NULL}, *old;
+    char path[PATH_MAX] = "", name[256] = "";
+    const char *entries, *end, *p;
+    unsigned char type;
+    size_t cap;
+    IDXREC *rec;
+    uint32_t i;
+
+    if (b->nold == 0 || (old = bsearch(&key, b->old, b->nold, sizeof(IDXOLD), compare_old)) == NULL)
+        return 0;
+    rec = (IDXREC *)old->rec;
+    if (rec->sec != d->mtime.tv_sec || rec->nsec != d->mtime.tv_nsec)
+        return 0;
+    strcpy(path, old->path); // holds the shared prefix, whatever the previous record was
+    if (index_record(map, size, old->rec - map, path, &rec, &entries, &end) == 0)
+        return 0;
+    d->blob = NULL;
+    d->len = 0;
+    for (i = 0, p = entries, cap = 0; i < rec->count; i++)
+    {
+        size_t n;
+        if ((p = index_entry(p, end, name, &type)) == NULL)
+        {
+            free(d->blob);
+            return 0;
+        }
+        n = strlen(name) + 1;
+        if (d->len + n + 1 > cap)
+            d->blob = realloc(d->blob, cap = (cap + n + 1) * 2);
+        d->blob[d->len++] = type;
+        memcpy(d->blob + d->len, name, n);
+        d->len += n;
+    }
+    d->count = rec->count;
+    return 1;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a + 1, *(char *const *)b + 1);
+}
+
+/*
+ * @brief read a directory of the tree (b->full)
+ * @return 0 or -1 if it can not be read (error printed)
+ */
+static int index_read(IDXBUILD *b, IDXDIR *d)
+{
+    char *blob = NULL, **sorted;
+    struct dirent64 *entry;
+    struct stat sb;
+    size_t len = 0, cap = 0, off;
+    uint32_t count = 0, i;
+    DIRREAD dir;
+
+    if (dir_open(&dir, AT_FDCWD, b->full) == -1)
+    {
+        fprintf(stderr, "myfind: %s: %s\n", b->full, strerror(errno));
+        return -1;
+    }
+    while ((entry = dir_next(&dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        unsigned char type = entry->d_type;
+        size_t n = strlen(name) + 1;
+
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        if (type == DT_UNKNOWN && fstatat(dir.fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+            type = IFTODT(sb.st_mode);
+        if (len + n + 1 > cap)
+            blob = realloc(blob, cap = (cap + n + 1) * 2);
+        blob[len++] = type;
+        memcpy(blob + len, name, n);
+        len += n;
+        count++;
+    }
+    dir_close(&dir);
+
+    // sorted, for the front coding
+    sorted = malloc((count + 1) * sizeof(char *));
+    for (i = 0, off = 0; i < count; i++, off += strlen(blob + off + 1) + 2)
+        sorted[i] = blob + off;
+    qsort(sorted, count, sizeof(char *), compare_names);
+    d->blob = malloc(len + 1);
+    for (i = 0, d->len = 0; i < count; i++)
+    {
+        size_t n = strlen(sorted[i] + 1) + 2;
+        memcpy(d->blob + d->len, sorted[i], n);
+        d->len += n;
+    }
+    d->count = count;
+    free(sorted);
+    free(blob);
+    b->reread++;
+    return 0;
+}
+
+/*
+ * @brief add the directory path (relative to the root) and its subdirectories
+ */
+static void index_walk(IDXBUILD *b, char *map, size_t size, const char *path, size_t plen)
+{
+    struct stat sb;
+    IDXDIR d;
+    size_t off;
+    int at;
+
+    if (b->rootlen + 1 + plen >= PATH_MAX)
+        return;
+    if (plen > 0)
+    {
+        b->full[b->rootlen] = '/';
+        memcpy(b->full + b->rootlen + 1, path, plen + 1);
+    }
+    else
+        b->full[b->rootlen] = '\0';
+    if (lstat(b->full, &sb) == -1 || !S_ISDIR(sb.st_mode))
+        return; // removed meanwhile
+    d.path = strdup(path);
+    d.mtime = sb.st_mtim;
+    if (!index_reuse(b, map, size, &d) && index_read(b, &d) == -1)
+    {
+        free(d.path);
+        return;
+    }
+
+    if (b->ndirs == b->cap)
+        b->dirs = realloc(b->dirs, (b->cap = b->cap ? b->cap * 2 : 256) * sizeof(IDXDIR));
+    at = b->ndirs++;
+    b->dirs[at] = d;
+    b->nentries += d.count;
+
+    for (off = 0; off < b->dirs[at].len;)
+    {
+        const char *entry = b->dirs[at].blob + off;
+        size_t n = strlen(entry + 1);
+
+        if (entry[0] == DT_DIR && plen + 1 + n < PATH_MAX)
+        {
+            char sub[PATH_MAX];
+            size_t slen = plen ? plen + 1 + n : n;
+
+            if (plen)
+                sprintf(sub, "%s/%s", path, entry + 1);
+            else
+                memcpy(sub, entry + 1, n + 1);
+            index_walk(b, map, size, sub, slen);
+        }
+        off += n + 2;
+    }
+}
+
+static size_t common_prefix(const char *a, const char *b, size_t max)
+{
+    size_t i = 0;
+
+    while (i < max && a[i] && a[i] == b[i])
+        i++;
+    return i;
+}
+
+/*
+ * @brief write the database aside and rename it over the old one
+ * @return 0 or -1
+ */
+static int index_write(IDXBUILD *b, const char *real)
+{
+    char *file = index_file(real), *tmp, *coded = NULL;
+    static const char zeros[8] = {0};
+    IDXHDR hdr = {FINDINDEX_MAGIC, FINDINDEX_VERSION, b->ndirs, strlen(real) + 1, b->nentries};
+    const char *prev = "";
+    size_t cap = 0;
+    FILE *fp;
+    int i, err;
+
+    if (file == NULL)
+        return -1;
+    tmp = malloc(strlen(file) + 32);
+    sprintf(tmp, "%s.%d", file, (int)getpid());
+    if ((fp = fopen(tmp, "we")) == NULL)
+    {
+        perror(tmp);
+        free(tmp);
+        free(file);
+        return -1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, fp);
+    fwrite(real, 1, hdr.rootlen, fp);
+    fwrite(zeros, 1, ALIGN8(sizeof(hdr) + hdr.rootlen) - sizeof(hdr) - hdr.rootlen, fp);
+
+    for (i = 0; i < b->ndirs; i++)
+    {
+        IDXDIR *d = &b->dirs[i];
+        IDXREC rec = {d->mtime.tv_sec, d->mtime.tv_nsec, d->count, 0};
+        uint16_t shared = common_prefix(prev, d->path, UINT16_MAX);
+        const char *name = "", *entry;
+        size_t len = 0, off, n, need = sizeof(shared) + strlen(d->path) + 1 + d->len + d->count;
+
+        if (need > cap)
+            coded = realloc(coded, cap = need * 2);
+        memcpy(coded, &shared, sizeof(shared));
+        len = sizeof(shared);
+        n = strlen(d->path + shared) + 1;
+        memcpy(coded + len, d->path + shared, n);
+        len += n;
+        for (off = 0; off < d->len; off += strlen(entry + 1) + 2)
+        {
+            unsigned char common;
+
+            entry = d->blob + off;
+            common = common_prefix(name, entry + 1, 255);
+            coded[len++] = common;
+            coded[len++] = entry[0];
+            n = strlen(entry + 1 + common) + 1;
+            memcpy(coded + len, entry + 1 + common, n);
+            len += n;
+            name = entry + 1;
+        }
+        rec.size = len;
+        fwrite(&rec, sizeof(rec), 1, fp);
+        fwrite(coded, 1, len, fp);
+        fwrite(zeros, 1, ALIGN8(sizeof(rec) + len) - sizeof(rec) - len, fp);
+        prev = d->path;
+    }
+    free(coded);
+
+    err = ferror(fp);
+    if (fclose(fp) == 0 && !err)
+        err = rename(tmp, file);
+    else
+        err = -1;
+    if (err)
+    {
+        perror(file);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(file);
+    return err ? -1 : 0;
+}
+
+/*
+ * @brief build or refresh the database of a tree
+ * @param const char* root - top of the tree
+ * @param FILE* out - the summary goes there
+ * @return 0 or -1 (error printed)
+ */
+int findindex_build(const char *root, FILE *out)
+{
+    IDXBUILD *b;
+    char real[PATH_MAX], *map;
+    size_t size = 0;
+    int i, ret;
+
+    if (realpath(root, real) == NULL)
+    {
+        fprintf(stderr, "myfind: %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+    b = calloc(1, sizeof(IDXBUILD));
+    b->rootlen = strlen(real);
+    memcpy(b->full, real, b->rootlen + 1);
+    if ((map = index_map(real, &size)) != NULL)
+        index_load_old(b, map, size);
+
+    index_walk(b, map, size, "", 0);
+    ret = b->ndirs > 0 ? index_write(b, real) : -1;
+    if (ret == 0)
+        fprintf(out, "%s: %d directories (%ld read), %llu entries\n", real, b->ndirs, b->reread,
+                (unsigned long long)b->nentries);
+
+    for (i = 0; i < b->ndirs; i++)
+    {
+        free(b->dirs[i].path);
+        free(b->dirs[i].blob);
+    }
+    for (i = 0; i < b->nold; i++)
+        free(b->old[i].path);
+    free(b->dirs);
+    free(b->old);
+    free(b);
+    if (map != NULL)
+        munmap(map, size);
+    return ret;
+}
+
+/*
+ * @brief go through the database of a tree
+ * @param const char* root - top of the tree, as given to findindex_build()
+ * @param dir - called for every directory (path relative to the root, "" for
+ *              the root, depth 0 for the root), returns 1 to look at its
+ *              entries, 0 to skip them, -1 to end the scan
+ * @param entry - called for every entry of the directories not skipped,
+ *                returns 0 or -1 to end the scan
+ * @param void* ctx - given to dir and entry
+ * @return 0 or -1 when there is no database for root (error printed)
+ */
+int findindex_scan(const char *root, int (*dir)(void *ctx, const char *path, int depth),
+                   int (*entry)(void *ctx, const char *path, const char *name, unsigned char type, int depth),
+                   void *ctx)
+{
+    char real[PATH_MAX], path[PATH_MAX] = "", name[256], *map;
+    const char *entries, *end, *p;
+    unsigned char type;
+    size_t size, off, next;
+    IDXREC *rec;
+    uint32_t i, j;
+
+    if (realpath(root, real) == NULL)
+    {
+        fprintf(stderr, "myfind: %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+    if ((map = index_map(real, &size)) == NULL)
+    {
+        fprintf(stderr, "myfind: no index of %s, make it with myfind --index %s\n", real, root);
+        return -1;
+    }
+    off = index_first(map);
+    for (i = 0; i < ((IDXHDR *)map)->ndirs; i++, off = next)
+    {
+        int depth = 0, look;
+
+        if ((next = index_record(map, size, off, path, &rec, &entries, &end)) == 0)
+        {
+            fprintf(stderr, "myfind: the index of %s is corrupted\n", real);
+            break;
+        }
+        if (path[0] != '\0')
+            for (depth = 1, p = path; *p; p++)
+                depth += *p == '/';
+        if ((look = dir(ctx, path, depth)) == -1)
+            break;
+        if (look == 0)
+            continue;
+        name[0] = '\0';
+        for (j = 0, p = entries; j < rec->count && (p = index_entry(p, end, name, &type)) != NULL; j++)
+            if (entry(ctx, path, name, type, depth + 1) == -1)
+                break;
+        if (j < rec->count && p != NULL)
+            break; // ended by entry
+    }
+    munmap(map, size);
+    return 0;
+}
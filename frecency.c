@@ -0,0 +1,377 @@
+/*
+ * @file frecency.c
+ * @brief Directories cd went to, ranked by frecency, for cd with a name that is not a directory
+ *
+ * Every successful cd adds 1 to the rank of the new directory and sets its
+ * time. cd WORD... with no such directory goes to the directory whose path
+ * has the words in that order (case does not matter, the last one in the
+ * last component) and the highest frecency: the rank weighted by how recent
+ * the last visit is (x4 within the hour, x2 the day, /2 the week, /4 older).
+ *
+ * The directories live in memory in an array sorted by path (a cd looks its
+ * directory up with bsearch), read from ~/.msh_dirs. The file has the
+ * format of z (path|rank|time), so it can be shared with it. It is read
+ * again only when it changed (inode, size or mtime): the lines another shell
+ * appended are read from where this one stopped, a new file is read whole.
+ * A visit (only in the interactive shell) appends the new rank of its
+ * directory under flock(), a path that comes back takes the highest rank as
+ * z does, so the shells running at the same time keep each other's visits.
+ * The file is written aside and renamed only when the appended lines
+ * outnumber the directories, or when the ranks add up to more than
+ * FRECENCY_MAX: they are all aged by 10% and the ones below 1 are forgotten.
+ */
+
+#include "header.h"
+
+typedef struct dir_rank {
+    char *path;
+    double rank;
+    time_t last;
+} DIRRANK;
+
+static DIRRANK *dirs = NULL;
+static int ndirs = 0, cap = 0;
+static double total = 0;    // sum of the ranks
+static long lines = 0;      // in the file, the appended ones too
+static struct stat loaded;  // the file as it was read, st_size up to the last whole line
+
+/*
+ * @brief ~/.msh_dirs
+ * @return malloc'd path or NULL when there is no $HOME
+ */
+static char *frecency_file()
+{
+    char *home = getenv("HOME"), *file;
+
+    if (home == NULL)
+        return NULL;
+    file = malloc(strlen(home) + strlen(FRECENCY_FILE) + 2);
+    sprintf(file, "%s/%s", home, FRECENCY_FILE);
+    return file;
+}
+
+static int compare_dirs(const void *a, const void *b)
+{
+    return strcmp(((const DIRRANK *)a)->path, ((const DIRRANK *)b)->path);
+}
+
+/*
+ * @brief the entry of dir
+ * @param int create - add it with rank 0 when it is not there
+ * @return the entry or NULL
+ */
+static DIRRANK *frecency_find(const char *dir, int create)
+{
+    DIRRANK key = {(char *)dir, 0, 0}, *d;
+    int lo = 0, hi = ndirs;
+
+    if ((d = bsearch(&key, dirs, ndirs, sizeof(DIRRANK), compare_dirs)) != NULL || !create)
+        return d;
+    while (lo < hi) // insertion point, the array stays sorted
+    {
+        int mid = (lo + hi) / 2;
+        if (strcmp(dirs[mid].path, dir) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (ndirs == cap)
+        dirs = realloc(dirs, (cap = cap ? cap * 2 : 64) * sizeof(DIRRANK));
+    memmove(dirs + lo + 1, dirs + lo, (ndirs - lo) * sizeof(DIRRANK));
+    ndirs++;
+    d = &dirs[lo];
+    d->path = strdup(dir);
+    d->rank = 0;
+    d->last = 0;
+    return d;
+}
+
+/*
+ * @brief a path seen again keeps the highest rank and the latest time
+ */
+static void frecency_fold(DIRRANK *d, double rank, time_t last)
+{
+    if (rank > d->rank)
+    {
+        total += rank - d->rank;
+        d->rank = rank;
+    }
+    if (last > d->last)
+        d->last = last;
+}
+
+/*
+ * @brief bring the array up to date with ~/.msh_dirs, nothing to do when it did not change
+ *
+ * lines appended to the file read before are added to the array, a new file
+ * (renamed in, shorter) replaces it
+ */
+static void frecency_load()
+{
+    char *file = frecency_file(), *line = NULL, *rank, *last;
+    size_t size = 0;
+    ssize_t len;
+    off_t end;
+    struct stat sb;
+    int i, n, tail;
+    FILE *fp;
+
+    if (file == NULL || stat(file, &sb) == -1)
+        memset(&sb, 0, sizeof(sb));
+    if (sb.st_dev == loaded.st_dev && sb.st_ino == loaded.st_ino && sb.st_size == loaded.st_size &&
+        sb.st_mtim.tv_sec == loaded.st_mtim.tv_sec && sb.st_mtim.tv_nsec == loaded.st_mtim.tv_nsec)
+    {
+        free(file);
+        return;
+    }
+    tail = sb.st_ino != 0 && sb.st_dev == loaded.st_dev && sb.st_ino == loaded.st_ino &&
+           sb.st_size > loaded.st_size;
+    if (!tail)
+    {
+        while (ndirs > 0)
+            free(dirs[--ndirs].path);
+        total = 0;
+        lines = 0;
+        loaded.st_size = 0;
+    }
+    if (sb.st_ino == 0 || (fp = fopen(file, "re")) == NULL)
+    {
+        loaded = sb;
+        free(file);
+        return;
+    }
+    end = loaded.st_size;
+    fseeko(fp, end, SEEK_SET);
+    while ((len = getline(&line, &size, fp)) != -1)
+    {
+        if (line[len - 1] != '\n')
+            break; // being appended, read next time
+        end += len;
+        lines++;
+        line[len - 1] = '\0';
+        // path|rank|time, the path may have '|'
+        if ((last = strrchr(line, '|')) == NULL)
+            continue;
+        *last++ = '\0';
+        if ((rank = strrchr(line, '|')) == NULL || line[0] != '/')
+            continue;
+        *rank++ = '\0';
+        if (tail)
+        {
+            frecency_fold(frecency_find(line, 1), atof(rank), atol(last));
+            continue;
+        }
+        if (ndirs == cap)
+            dirs = realloc(dirs, (cap = cap ? cap * 2 : 64) * sizeof(DIRRANK));
+        dirs[ndirs].path = strdup(line);
+        dirs[ndirs].rank = atof(rank);
+        dirs[ndirs++].last = atol(last);
+    }
+    free(line);
+    fclose(fp);
+    free(file);
+    loaded = sb;
+    loaded.st_size = end;
+    if (tail)
+        return;
+    // sorted and each path once
+    qsort(dirs, ndirs, sizeof(DIRRANK), compare_dirs);
+    for (n = 0, i = 0; i < ndirs; i++)
+    {
+        if (n > 0 && strcmp(dirs[n - 1].path, dirs[i].path) == 0)
+        {
+            frecency_fold(&dirs[n - 1], dirs[i].rank, dirs[i].last);
+            free(dirs[i].path);
+        }
+        else
+            dirs[n++] = dirs[i];
+    }
+    for (ndirs = n, total = 0, i = 0; i < ndirs; i++)
+        total += dirs[i].rank;
+}
+
+static void frecency_save()
+{
+    char *file = frecency_file(), *tmp;
+    struct stat sb;
+    FILE *fp;
+    int i, err;
+
+    if (file == NULL)
+        return;
+    tmp = malloc(strlen(file) + 32);
+    sprintf(tmp, "%s.%d", file, (int)getpid());
+    if ((fp = fopen(tmp, "we")) != NULL)
+    {
+        for (i = 0; i < ndirs; i++)
+            fprintf(fp, "%s|%g|%ld\n", dirs[i].path, dirs[i].rank, (long)dirs[i].last);
+        // the file as it is now is the one in memory, before another shell can append to it
+        err = fflush(fp) != 0 || ferror(fp) || fstat(fileno(fp), &sb) == -1;
+        if (fclose(fp) == 0 && !err && rename(tmp, file) == 0)
+        {
+            loaded = sb;
+            lines = ndirs;
+        }
+        else
+            unlink(tmp);
+    }
+    free(tmp);
+    free(file);
+}
+
+/*
+ * @brief take the lock of ~/.msh_dirs
+ * @return descriptor to append to and to close to release it, or -1
+ *
+ * the lock is on the file itself: when another shell renamed a new file in
+ * while this one waited, the lock is taken again on the new one
+ */
+static int frecency_lock()
+{
+    char *file = frecency_file();
+    struct stat locked, current;
+    int fd = -1;
+
+    while (file != NULL && (fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) != -1)
+    {
+        flock(fd, LOCK_EX);
+        if (fstat(fd, &locked) == 0 && stat(file, &current) == 0 &&
+            locked.st_dev == current.st_dev && locked.st_ino == current.st_ino)
+            break;
+        close(fd);
+    }
+    free(file);
+    return fd;
+}
+
+/*
+ * @brief all the ranks lose 10%, the directories below 1 are forgotten
+ */
+static void frecency_age()
+{
+    int i, n = 0;
+
+    for (total = 0, i = 0; i < ndirs; i++)
+    {
+        dirs[i].rank *= 0.9;
+        if (dirs[i].rank >= 1)
+        {
+            total += dirs[i].rank;
+            dirs[n++] = dirs[i];
+        }
+        else
+            free(dirs[i].path);
+    }
+    ndirs = n;
+}
+
+/*
+ * @brief cd went to dir
+ * @param const char* dir - absolute path
+ */
+void frecency_add(const char *dir)
+{
+    DIRRANK *d;
+    char *line;
+    int len, lock = frecency_lock();
+    struct stat sb;
+
+    frecency_load();
+    d = frecency_find(dir, 1);
+    total += 1;
+    d->rank += 1;
+    d->last = time(NULL);
+
+    if (total > FRECENCY_MAX || lines >= 2L * ndirs + 64)
+    {
+        if (total > FRECENCY_MAX)
+            frecency_age();
+        frecency_save();
+    }
+    else if (lock != -1 && (len = asprintf(&line, "%s|%g|%ld\n", d->path, d->rank, (long)d->last)) != -1)
+    {
+        // one write: a shell reading without the lock sees the whole line or none of it
+        if (write(lock, line, len) == len && fstat(lock, &sb) == 0 && sb.st_size == loaded.st_size + len)
+        {
+            loaded = sb;
+            lines++;
+        }
+        free(line);
+    }
+    if (lock != -1)
+        close(lock);
+}
+
+static double frecency(DIRRANK *d, time_t now)
+{
+    time_t age = now - d->last;
+
+    if (age < 3600)
+        return d->rank * 4;
+    if (age < 86400)
+        return d->rank * 2;
+    if (age < 604800)
+        return d->rank / 2;
+    return d->rank / 4;
+}
+
+/*
+ * @brief the words are in the path, in that order, the last one in the last component
+ */
+static int frecency_matches(const char *path, char **words)
+{
+    const char *p = path, *last = strrchr(path, '/');
+    int i;
+
+    for (i = 0; words[i] != NULL; i++)
+    {
+        if (words[i + 1] == NULL && p <= last)
+            p = last + 1;
+        if ((p = strcasestr(p, words[i])) == NULL)
+            return 0;
+        p += strlen(words[i]);
+    }
+    return 1;
+}
+
+/*
+ * @brief best directory for cd words...
+ * @param char** words - NULL terminated
+ * @return the path (valid until the next frecency_add) or NULL
+ *
+ * a directory that does not exist anymore is dropped and the next best is taken
+ */
+const char *frecency_match(char **words)
+{
+    time_t now = time(NULL);
+    struct stat sb;
+    int i, best;
+
+    frecency_load();
+    for (;;)
+    {
+        double score = 0;
+
+        best = -1;
+        for (i = 0; i < ndirs; i++)
+        {
+            double f;
+            if (!frecency_matches(dirs[i].path, words))
+                continue;
+            f = frecency(&dirs[i], now);
+            if (best == -1 || f > score || (f == score && strlen(dirs[i].path) < strlen(dirs[best].path)))
+            {
+                best = i;
+                score = f;
+            }
+        }
+        if (best == -1)
+            return NULL;
+        if (stat(dirs[best].path, &sb) == 0 && S_ISDIR(sb.st_mode))
+            return dirs[best].path;
+        total -= dirs[best].rank;
+        free(dirs[best].path);
+        memmove(dirs + best, dirs + best + 1, (ndirs - best - 1) * sizeof(DIRRANK));
+        ndirs--;
+    }
+}
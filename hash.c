@@ -0,0 +1,221 @@
+/*
+ * @file hash.c
+ * @brief Hash table of the commands already resolved in $PATH
+ *
+ * The first time a command is executed its absolute path is searched in the
+ * $PATH directories and remembered, the next executions go straight to execv().
+ * The table is emptied when $PATH changes and an entry is dropped when the
+ * index watcher (complete.c) sees its name created or removed in $PATH.
+ */
+
+#include "header.h"
+
+typedef struct hash_entry {
+    char *name;
+    char *path; // absolute path of the executable
+    int hits;
+    struct hash_entry *next;
+} HASHENTRY;
+
+static HASHENTRY *table[HASH_SIZE];
+static pthread_mutex_t hash_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *hashed_path = NULL; // $PATH the table was filled with
+static long hits = 0, misses = 0;
+
+/*
+ * @brief djb2 string hash
+ */
+static unsigned int hash_string(const char *s)
+{
+    unsigned int h = 5381;
+
+    while (*s)
+        h = h * 33 + (unsigned char)*s++;
+    return h % HASH_SIZE;
+}
+
+/*
+ * @brief empty the table, must be called with hash_mutex held
+ */
+static void hash_clear()
+{
+    HASHENTRY *e, *next;
+    int i;
+
+    for (i = 0; i < HASH_SIZE; i++)
+    {
+        for (e = table[i]; e != NULL; e = next)
+        {
+            next = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+        table[i] = NULL;
+    }
+}
+
+/*
+ * @brief search a command in the $PATH directories
+ * @param const char* name - command
+ * @param const char* var - value of $PATH
+ * @return malloc'd absolute path or NULL
+ */
+static char *hash_search(const char *name, const char *var)
+{
+    const char *dir = var, *end;
+    char *result;
+    struct stat sb;
+    size_t len;
+
+    while (*dir)
+    {
+        end = strchr(dir, ':');
+        len = end ? (size_t)(end - dir) : strlen(dir);
+        result = malloc(len + strlen(name) + 3);
+        if (len == 0) // empty entry is the current directory
+            strcpy(result, ".");
+        else
+        {
+            memcpy(result, dir, len);
+            result[len] = '\0';
+        }
+        strcat(result, "/");
+        strcat(result, name);
+        if (stat(result, &sb) == 0 && S_ISREG(sb.st_mode) && access(result, X_OK) == 0)
+            return result;
+        free(result);
+        if (end == NULL)
+            break;
+        dir = end + 1;
+    }
+    return NULL;
+}
+
+/*
+ * @brief resolve a command to the path to execute
+ * @param const char* name - argv[0]
+ * @return path (in line_arena, valid until the line is done) or NULL if not found
+ *
+ * names with a '/' are not searched nor remembered
+ */
+char *hash_lookup(const char *name)
+{
+    const char *var = getenv("PATH");
+    unsigned int h = hash_string(name);
+    HASHENTRY *e;
+    char *result;
+
+    if (strchr(name, '/') != NULL)
+        return (char *)name;
+    if (var == NULL)
+        var = "";
+
+    // CRITICAL AREA
+    pthread_mutex_lock(&hash_mutex);
+    if (hashed_path == NULL || strcmp(hashed_path, var) != 0)
+    {
+        hash_clear();
+        free(hashed_path);
+        hashed_path = strdup(var);
+    }
+    for (e = table[h]; e != NULL; e = e->next)
+    {
+        if (strcmp(e->name, name) == 0)
+        {
+            e->hits++;
+            hits++;
+            result = arena_strdup(&line_arena, e->path);
+            pthread_mutex_unlock(&hash_mutex);
+            return result;
+        }
+    }
+    misses++;
+    pthread_mutex_unlock(&hash_mutex);
+    // END OF CRITICAL AREA
+
+    if ((result = hash_search(name, var)) == NULL)
+        return NULL;
+
+    e = malloc(sizeof(HASHENTRY));
+    e->name = strdup(name);
+    e->path = result;
+    e->hits = 1;
+    pthread_mutex_lock(&hash_mutex);
+    e->next = table[h];
+    table[h] = e;
+    result = arena_strdup(&line_arena, e->path);
+    pthread_mutex_unlock(&hash_mutex);
+    return result;
+}
+
+/*
+ * @brief forget a command, it is searched again on the next use
+ * @param const char* name - command
+ */
+void hash_remove(const char *name)
+{
+    HASHENTRY **p, *e;
+
+    pthread_mutex_lock(&hash_mutex);
+    for (p = &table[hash_string(name)]; (e = *p) != NULL; p = &e->next)
+    {
+        if (strcmp(e->name, name) == 0)
+        {
+            *p = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&hash_mutex);
+}
+
+/*
+ * @brief builtin hash
+ *
+ * hash    - print the remembered commands and the hit/miss counters
+ * hash -r - forget every command and reset the counters
+ *
+ * the entries are copied under the lock and printed after: out may be a pipe
+ * whose reader is not started yet while the shell needs hash_lookup()
+ */
+int hash_builtin(CMD *root, FILE *out)
+{
+    HASHENTRY *e, *copy = NULL;
+    long h, m;
+    int i, n = 0, cap = 0;
+
+    pthread_mutex_lock(&hash_mutex);
+    if (root->argv[1] != NULL && strcmp(root->argv[1], "-r") == 0)
+    {
+        hash_clear();
+        hits = misses = 0;
+        pthread_mutex_unlock(&hash_mutex);
+        return 0;
+    }
+    for (i = 0; i < HASH_SIZE; i++)
+    {
+        for (e = table[i]; e != NULL; e = e->next)
+        {
+            if (n == cap)
+                copy = realloc(copy, (cap = cap ? cap * 2 : 16) * sizeof(HASHENTRY));
+            copy[n].path = strdup(e->path);
+            copy[n++].hits = e->hits;
+        }
+    }
+    h = hits;
+    m = misses;
+    pthread_mutex_unlock(&hash_mutex);
+
+    fprintf(out, "hits\tcommand\n");
+    for (i = 0; i < n; i++)
+    {
+        fprintf(out, "%4d\t%s\n", copy[i].hits, copy[i].path);
+        free(copy[i].path);
+    }
+    fprintf(out, "hash: %ld hits, %ld misses\n", h, m);
+    free(copy);
+    return 0;
+}
@@ -1,4 +1,5 @@
 // LIBS
+#define _GNU_SOURCE // pipe2, F_SETPIPE_SZ, closefrom
 #include <dirent.h>
 #include <errno.h>
 #include <sys/types.h>
@@ -14,18 +15,52 @@
 #include <unistd.h>
 #include <string.h>
 #include <pthread.h>
-#include <semaphore.h>
 #include <pwd.h>
 #include <grp.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <stdatomic.h>
+#include <fnmatch.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <time.h>
 // MACROS
-#define MAXARGS 10
-#define N 5
-#define CONSUMERS 2
+#define MAXARGS 64
 #define VERMELHO  "\x1B[31m\e[1m"
 #define VERDE  "\x1B[32m\e[1m"
 #define AZUL  "\x1B[34m\e[1m"
 #define CYAN  "\x1B[36m\e[1m"
 #define BRANCO  "\e[97m\e[0m"
+#define CACHE_FILE ".msh_cache"
+#define CACHE_MAGIC 0x4348534d // "MSHC"
+#define CACHE_VERSION 1
+#define FINDINDEX_FILE ".msh_findindex" // + '.' + hash of the root
+#define FINDINDEX_MAGIC 0x4946534d // "MSFI"
+#define FINDINDEX_VERSION 1
+#define FRECENCY_FILE ".msh_dirs"
+#define FRECENCY_MAX 9000 // sum of the ranks before they are aged
+#define HISTORY_FILE ".msh_history"
+#define HISTORY_LOAD 1000 // last lines given to readline at startup
+#define HISTORY_BUCKETS 65536 // posting lists of the trigram index (power of 2)
+#define HISTORY_SCAN (1 << 20) // bytes searched at a time while the index is being built
+#define HASH_SIZE 256
+#define BUILTIN_SLOTS 32
+#define ARENA_CHUNK 4096
+#define POOL_MAX 64 // workers of a pool
+#define BUILTIN_THREAD 1 // may run in a thread of the shell as a pipeline stage
+#define DIRREAD_BUF 65536 // bytes read by one getdents64()
+#define COMPLETE_DIRS 16 // directory listings kept for the completion of file names
+#define COMPLETE_COMMAND 0   // what completion_context() finds at the cursor
+#define COMPLETE_DIRECTORY 1
+#define COMPLETE_FILE 2
 
 // STRUCTS
 typedef struct command {
@@ -34,23 +69,188 @@ typedef struct command {
     char *infile;
     char *outfile;
     char *errfile;
+    int background; // pipeline ends with & (set in the first node)
+    int timed;      // pipeline starts with time (set in the first node)
+    int error;      // syntax error, nothing to run (set in the first node)
     struct command *next;
 } CMD;
 
+/* token of a command line, a slice of the line (see lexer.c) */
+enum token_type { TOK_WORD, TOK_PIPE, TOK_IN, TOK_OUT, TOK_ERR, TOK_AMP };
+
+typedef struct token {
+    int type;
+    int off;    // offset in the line
+    int len;
+    int quoted; // has quotes or escapes to remove
+} TOKEN;
+
+/* bump allocator, see arena.c */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+} ARENACHUNK;
+
+typedef struct arena {
+    ARENACHUNK *head;
+    ARENACHUNK *current;
+} ARENA;
+
+/* builtin command, see builtin.c */
+typedef struct builtin {
+    const char *name;
+    int (*fn)(CMD *cmd, FILE *out);
+    int flags;
+} BUILTIN;
+
+/* pool of worker threads, see pool.c */
+typedef struct pool POOL;
+
+/* resources used by a stage of a timed pipeline, see timing.c */
+typedef struct stage_time {
+    CMD *cmd;
+    pid_t pid;        // 0 for a builtin run by the shell
+    int status;
+    struct timespec start, end;
+    struct rusage ru;
+} STAGETIME;
+
+/* builtin running as a pipeline stage in a thread of the shell */
+typedef struct stage {
+    BUILTIN *b;
+    CMD *cmd;
+    FILE *out;
+    int status;
+    STAGETIME *time;  // NULL when the pipeline is not timed
+    pthread_t tid;
+} STAGE;
+
+/* background pipeline, see jobs.c */
+typedef struct job {
+    int id;       // [n] in the listings, 0 = free slot
+    pid_t pgid;
+    pid_t *pids;  // -1 once collected
+    int npids;
+    int alive;    // children not collected yet
+    pid_t last;   // last stage, gives the status
+    int status;
+    int stopped;  // by CTRL + Z, until fg continues it
+    char *cmdline;
+} JOB;
+
+/* shell options, changed with the set builtin */
+typedef struct options {
+    int pipesize;  // F_SETPIPE_SZ of the pipes of a pipeline, 0 = default
+    int timing;    // every pipeline is timed, as with the time prefix
+    char *timelog; // file the timings are appended to (JSON lines) or NULL
+} OPTIONS;
+
+/* executables of one $PATH directory, as scanned or loaded from the cache */
+typedef struct dir_index {
+    char *path;
+    struct timespec mtime; // mtime of the directory when it was read
+    char **names;
+    int n;
+    int stale;   // must be rescanned by insert_directories()
+    int missing; // directory could not be stat'ed, never cached
+} DIRINDEX;
+
+/* directory being read by dir_next() */
+typedef struct dirread {
+    int fd;       // also usable for the *at() calls on the entries
+    char *buf;
+    int pos, end; // entries left in buf[pos..end-1]
+} DIRREAD;
+
 // FUNCTIONS
 CMD *insert_command();
 void free_command_list();
 void print_command_list();
-void exec_comandos(CMD* root);
+int exec_comandos(CMD* root);
+int run_line(char *line);
+int run_batch(int argc, const char *argv[]);
 int n_commands(CMD *root);
 void update_path();
 CMD * parse_line(char *);
 int parse_path();
-void myexec(CMD* root);
+int exec_myls(CMD *root, FILE *out);
+int exec_myfind(CMD *root, FILE *out);
+int findindex_build(const char *root, FILE *out);
+int findindex_scan(const char *root, int (*dir)(void *ctx, const char *path, int depth),
+                   int (*entry)(void *ctx, const char *path, const char *name, unsigned char type, int depth),
+                   void *ctx);
 void *insert_directories(void *pos);
 char **character_name_completion(const char *, int, int);
 char *character_name_generator(const char *, int);
-void *list_dir(void *name);
-void *produtor(void *name);
-void *consumidor(void *name);
+char *file_name_generator(const char *text, int state);
+char *directory_name_generator(const char *text, int state);
+int completion_context(const char *line, int start);
+void cache_load(int n);
+void index_add(char **names, int n);
+void index_remove(const char *name);
+void index_build(int size);
+void *index_path(void *n);
+int index_lower_bound(const char *text, int len);
+char *hash_lookup(const char *name);
+void hash_remove(const char *name);
+int hash_builtin(CMD *root, FILE *out);
+pid_t spawn_command(CMD *aux, const char *prog, int in, int out, pid_t *pgid);
+pid_t spawn_builtin(BUILTIN *b, CMD *aux, int in, int out, pid_t *pgid);
+void jobs_init();
+int exit_status(int status);
+void job_add(CMD *root, pid_t pgid, pid_t *pids, int n);
+void job_stop(CMD *root, pid_t pgid, pid_t *pids, int n, int status);
+void job_reap();
+int job_event_hook();
+void job_notify(int report);
+int builtin_jobs(CMD *cmd, FILE *out);
+int builtin_wait(CMD *cmd, FILE *out);
+int builtin_fg(CMD *cmd, FILE *out);
+BUILTIN *builtin_lookup(const char *name);
+int builtin_run(BUILTIN *b, CMD *cmd);
+int stage_start(STAGE *st, int in, int out);
+int pool_default_size();
+POOL *pool_create(int n, void (*fn)(POOL *p, int worker, void *task), void *ctx);
+void *pool_context(POOL *p);
+void pool_submit(POOL *p, int worker, void *task);
+void pool_wait(POOL *p);
+void timing_begin(STAGETIME *t, CMD *cmd);
+void timing_end(STAGETIME *t, int status);
+void timing_usage(STAGETIME *t, const struct rusage *before);
+void timing_add(struct rusage *sum, const struct rusage *ru);
+void timing_report(STAGETIME *t, int n);
+int redirect_fd(const char *file, int target, int *saved);
+void *arena_alloc(ARENA *a, size_t size);
+char *arena_strdup(ARENA *a, const char *s);
+char *arena_strndup(ARENA *a, const char *s, size_t n);
+void arena_reset(ARENA *a);
+int lex_line(const char *line, TOKEN *tokens);
+char *lex_unquote(char *word, int len);
+void cache_save(int n);
+void frecency_add(const char *dir);
+const char *frecency_match(char **words);
+void history_init(int load);
+void history_add(const char *line);
+const char *history_find(const char *query, int nth, size_t *len);
+int history_isearch(int count, int key);
+int builtin_history(CMD *cmd, FILE *out);
+void history_index_wait();
+size_t history_index_bytes();
+int dir_open(DIRREAD *d, int at, const char *path);
+struct dirent64 *dir_next(DIRREAD *d);
+void dir_close(DIRREAD *d);
+
+// GLOBALS
+extern char **directories;
+extern DIRINDEX *dir_index;
+extern int last_status;
+extern ARENA line_arena;
+extern OPTIONS options;
+extern int interactive;
+extern atomic_int interrupted;
+extern atomic_long dir_syscalls;
+extern __thread STAGETIME *timing_stage;
+extern long listing_reads;
 
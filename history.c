@@ -0,0 +1,541 @@
+/*
+ * @file history.c
+ * @brief Command history kept in ~/.msh_history, with an indexed reverse search (Ctrl+R)
+ *
+ * The file is only ever appended to: every line is one write() on an
+ * O_APPEND descriptor under flock(), so concurrent shells can share it.
+ * At startup it is memory-mapped, nothing is parsed: the last HISTORY_LOAD
+ * lines are found from the end and handed to readline for the arrows.
+ *
+ * The search index is only built from the first search (CTRL+R) on, a shell
+ * that never searches does not pay for it. A thread builds it over a mapping
+ * of its own; until it is done the searches scan the mapping of the shell
+ * from the end, HISTORY_SCAN bytes at a time with memmem(), and drop the
+ * lines already seen. Once built the index belongs to the shell, it is
+ * extended (the file is mapped again) when the file grew, by this shell or
+ * another. history TEXT in a script only scans.
+ *   - offs: where every line starts in the mapping
+ *   - a hash table from the text of a line to its last copy; the older
+ *     copies are flagged in superseded, a search only reports the last one
+ *   - HISTORY_BUCKETS posting lists of line numbers: every trigram of a line
+ *     (hashed to a bucket) adds the line to its bucket once
+ * A query of 3 bytes or more walks the shortest list among its trigrams
+ * from the newest line and checks the candidates with memmem(); shorter
+ * queries scan the lines from the newest.
+ *
+ * A posting list keeps the differences between its line numbers as LEB128
+ * varints (7 bits a byte, the high bit set on every byte but the last of a
+ * number): most differences fit in one or two bytes instead of four, and
+ * the list can still be read backwards, from the newest line. With the
+ * lines of bench/msh_bench the index takes about 45 bytes a line
+ * (history_index_bytes()).
+ */
+
+#include "header.h"
+
+/* lines of a bucket, in increasing order, as varint differences */
+typedef struct postings {
+    uint8_t *bytes;
+    uint32_t len, cap;
+    uint32_t last; // newest line of the list
+} POSTINGS;
+
+static int fd = -1;                // O_APPEND descriptor of the file
+static char *map = NULL;           // read-only mapping of the file
+static size_t map_size = 0;
+static int background = 0;         // the index is built by a thread (interactive shell)
+static pthread_t indexer;
+static atomic_int index_state = 0; // 0 none, 1 the thread builds it, 2 built, 3 the thread joined
+static char *imap = NULL;          // mapping the index refers to
+static size_t imap_size = 0;
+static size_t indexed = 0;         // bytes of imap already in the index
+static size_t *offs = NULL;        // start of every line
+static uint32_t nlines = 0, lines_cap = 0;
+static uint8_t *superseded = NULL; // a later line has the same text
+static uint32_t *latest = NULL;    // hash table of the texts: line number + 1, 0 = empty
+static uint32_t latest_slots = 0, ntexts = 0;
+static POSTINGS *buckets = NULL;
+
+/*
+ * @brief ~/.msh_history
+ * @return malloc'd path or NULL when there is no $HOME
+ */
+static char *history_file()
+{
+    char *home = getenv("HOME"), *file;
+
+    if (home == NULL)
+        return NULL;
+    file = malloc(strlen(home) + strlen(HISTORY_FILE) + 2);
+    sprintf(file, "%s/%s", home, HISTORY_FILE);
+    return file;
+}
+
+/*
+ * @brief map the file again when it grew
+ * @param char** m, size_t* size - the mapping (of the shell or of the index)
+ * @return 0 or -1 when there is no history
+ */
+static int history_map(char **m, size_t *size)
+{
+    struct stat sb;
+    char *grown;
+
+    if (fd == -1 || fstat(fd, &sb) == -1)
+        return -1;
+    if ((size_t)sb.st_size == *size)
+        return 0;
+    if (sb.st_size == 0)
+        return -1;
+    if ((grown = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+        return -1;
+    if (*m != NULL)
+        munmap(*m, *size);
+    *m = grown;
+    *size = sb.st_size;
+    return 0;
+}
+
+static size_t line_len(uint32_t id)
+{
+    const char *nl = memchr(imap + offs[id], '\n', imap_size - offs[id]);
+    return nl - (imap + offs[id]);
+}
+
+static uint32_t text_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u; // FNV-1a
+
+    while (len--)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static unsigned int trigram_bucket(const char *s)
+{
+    uint32_t t = (unsigned char)s[0] << 16 | (unsigned char)s[1] << 8 | (unsigned char)s[2];
+    return (t * 2654435761u) >> 16 & (HISTORY_BUCKETS - 1);
+}
+
+static void latest_grow()
+{
+    uint32_t *old = latest, slots = latest_slots, i, k;
+
+    latest_slots = slots ? slots * 2 : 4096;
+    latest = calloc(latest_slots, sizeof(uint32_t));
+    for (i = 0; i < slots; i++)
+    {
+        if (old[i] == 0)
+            continue;
+        k = text_hash(imap + offs[old[i] - 1], line_len(old[i] - 1)) & (latest_slots - 1);
+        while (latest[k] != 0)
+            k = (k + 1) & (latest_slots - 1);
+        latest[k] = old[i];
+    }
+    free(old);
+}
+
+/*
+ * @brief line id is the last copy of its text, flag the one before
+ */
+static void latest_set(uint32_t id, const char *s, size_t len)
+{
+    uint32_t k;
+
+    if (2 * (ntexts + 1) > latest_slots)
+        latest_grow();
+    for (k = text_hash(s, len) & (latest_slots - 1); latest[k] != 0; k = (k + 1) & (latest_slots - 1))
+    {
+        uint32_t other = latest[k] - 1;
+        if (line_len(other) == len && memcmp(imap + offs[other], s, len) == 0)
+        {
+            superseded[other] = 1;
+            latest[k] = id + 1;
+            return;
+        }
+    }
+    latest[k] = id + 1;
+    ntexts++;
+}
+
+static void postings_add(POSTINGS *p, uint32_t id)
+{
+    uint32_t delta;
+
+    if (p->len > 0 && p->last == id) // trigram seen before in the line
+        return;
+    delta = p->len > 0 ? id - p->last : id + 1; // the first one from -1
+    if (p->len + 5 > p->cap)
+        p->bytes = realloc(p->bytes, p->cap = p->cap ? p->cap + p->cap / 2 + 5 : 8);
+    for (; delta >= 0x80; delta >>= 7)
+        p->bytes[p->len++] = delta | 0x80;
+    p->bytes[p->len++] = delta;
+    p->last = id;
+}
+
+/*
+ * @brief line before *id in the list, walking backwards
+ * @param uint32_t* pos - end of the varint of *id (p->len to start from p->last)
+ * @return 0, or -1 when *id was the oldest
+ */
+static int postings_prev(const POSTINGS *p, uint32_t *pos, uint32_t *id)
+{
+    uint32_t start = *pos - 1, delta = 0, i;
+
+    while (start > 0 && p->bytes[start - 1] & 0x80)
+        start--;
+    for (i = *pos; i-- > start; )
+        delta = delta << 7 | (p->bytes[i] & 0x7f);
+    *pos = start;
+    *id -= delta;
+    return start == 0 ? -1 : 0;
+}
+
+/*
+ * @brief add the complete lines of the file not indexed yet
+ */
+static void history_extend()
+{
+    const char *p, *end, *nl;
+
+    if (history_map(&imap, &imap_size) == -1)
+        return;
+    p = imap + indexed;
+    end = imap + imap_size;
+
+    if (buckets == NULL)
+        buckets = calloc(HISTORY_BUCKETS, sizeof(POSTINGS));
+    while (p < end && (nl = memchr(p, '\n', end - p)) != NULL)
+    {
+        size_t len = nl - p, i;
+
+        if (len > 0)
+        {
+            if (nlines == lines_cap)
+            {
+                lines_cap = lines_cap ? lines_cap * 2 : 1024;
+                offs = realloc(offs, lines_cap * sizeof(size_t));
+                superseded = realloc(superseded, lines_cap);
+            }
+            offs[nlines] = p - imap;
+            superseded[nlines] = 0;
+            latest_set(nlines, p, len);
+            for (i = 0; i + 3 <= len; i++)
+                postings_add(&buckets[trigram_bucket(p + i)], nlines);
+            nlines++;
+        }
+        p = nl + 1;
+    }
+    indexed = p - imap;
+}
+
+static void *history_index_thread(void *arg)
+{
+    setpriority(PRIO_PROCESS, gettid(), 10); // below the shell: typing stays responsive
+    history_extend();
+    atomic_store(&index_state, 2);
+    return NULL;
+}
+
+/*
+ * @brief wait for the thread building the index, if there is one
+ */
+void history_index_wait()
+{
+    if (atomic_load(&index_state) == 1 || atomic_load(&index_state) == 2)
+    {
+        pthread_join(indexer, NULL);
+        atomic_store(&index_state, 3);
+    }
+}
+
+/*
+ * @brief start of the nth line from the end of the mapping (the file ends with '\n')
+ */
+static const char *history_tail(int n)
+{
+    const char *end = map + map_size, *p;
+    int k = 0;
+
+    for (p = end; p > map; p--)
+        if (p[-1] == '\n' && p < end && ++k == n)
+            break;
+    return p;
+}
+
+/*
+ * @brief open the history file and map it
+ * @param int load - give the last HISTORY_LOAD lines to readline and bind CTRL+R
+ */
+void history_init(int load)
+{
+    char *file = history_file();
+    const char *p, *nl;
+
+    if (file == NULL)
+        return;
+    fd = open(file, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    free(file);
+    if (!load)
+        return;
+    background = 1;
+    rl_bind_key(CTRL('R'), history_isearch);
+    if (fd == -1 || history_map(&map, &map_size) == -1)
+        return;
+    for (p = history_tail(HISTORY_LOAD); p < map + map_size && (nl = memchr(p, '\n', map + map_size - p)) != NULL; p = nl + 1)
+    {
+        char *line = strndup(p, nl - p);
+        if (*line)
+            add_history(line);
+        free(line);
+    }
+}
+
+/*
+ * @brief add a line to readline and append it to the file
+ *
+ * the same line twice in a row is kept once
+ */
+void history_add(const char *line)
+{
+    static char *last = NULL;
+    struct iovec iov[2] = {{(void *)line, strlen(line)}, {"\n", 1}};
+    HIST_ENTRY *prev = history_get(history_base + history_length - 1);
+
+    if (prev == NULL || strcmp(prev->line, line) != 0)
+        add_history(line);
+    if (fd == -1 || strchr(line, '\n') != NULL || (last != NULL && strcmp(last, line) == 0))
+        return;
+    free(last);
+    last = strdup(line);
+    // one write under the lock: the line never mixes with the one of another shell
+    flock(fd, LOCK_EX);
+    writev(fd, iov, 2);
+    flock(fd, LOCK_UN);
+}
+
+/*
+ * @brief history_find without the index: the lines of the mapping from the
+ * newest, HISTORY_SCAN bytes of them at a time searched with memmem()
+ */
+static const char *history_scan(const char *query, int nth, size_t *len)
+{
+    size_t qlen = strlen(query), nhits, hits_cap = 0, nseen = 0, seen_cap = 0, k, i, l;
+    const char *end, *start, *line, *hit, *nl, **hits = NULL, *found = NULL;
+    struct iovec *seen = NULL; // the distinct lines that matched, newest first
+
+    if (memchr(query, '\n', qlen) != NULL || (end = memrchr(map, '\n', map_size)) == NULL)
+        return NULL;
+    for (end++; end > map && found == NULL; end = start)
+    {
+        // whole lines: back to the start of the line
+        start = end - map > HISTORY_SCAN ? end - HISTORY_SCAN : map;
+        if (start > map)
+            start = (line = memrchr(map, '\n', start - map)) != NULL ? line + 1 : map;
+        for (nhits = 0, line = start; line < end && (hit = memmem(line, end - line, query, qlen)) != NULL; line = nl + 1)
+        {
+            nl = memchr(hit, '\n', end - hit);
+            if (nhits == hits_cap)
+                hits = realloc(hits, (hits_cap = hits_cap ? hits_cap * 2 : 64) * sizeof(char *));
+            hits[nhits++] = (hit = memrchr(line, '\n', hit - line)) != NULL ? hit + 1 : line;
+        }
+        for (k = nhits; k-- > 0 && found == NULL; )
+        {
+            l = (const char *)memchr(hits[k], '\n', end - hits[k]) - hits[k];
+            for (i = 0; i < nseen && (seen[i].iov_len != l || memcmp(seen[i].iov_base, hits[k], l) != 0); i++)
+                ;
+            if (i < nseen || l == 0) // a newer copy matched already
+                continue;
+            if (nseen == seen_cap)
+                seen = realloc(seen, (seen_cap = seen_cap ? seen_cap * 2 : 16) * sizeof(struct iovec));
+            seen[nseen].iov_base = (void *)hits[k];
+            seen[nseen++].iov_len = l;
+            if (nth-- == 0)
+            {
+                found = hits[k];
+                *len = l;
+            }
+        }
+    }
+    free(hits);
+    free(seen);
+    return found;
+}
+
+/*
+ * @brief nth (from 0) most recent distinct line that contains query
+ * @param size_t* len - set to the length of the line
+ * @return the line (not '\0' terminated, valid until the next search) or NULL
+ *
+ * the first search of the interactive shell starts the thread that builds
+ * the index, the ones before it is done scan the file
+ */
+const char *history_find(const char *query, int nth, size_t *len)
+{
+    size_t qlen = strlen(query), i;
+    POSTINGS *best = NULL;
+    uint32_t pos, id;
+    int more;
+
+    if (history_map(&map, &map_size) == -1)
+        return NULL;
+    if (background && atomic_load(&index_state) == 0)
+    {
+        atomic_store(&index_state, 1);
+        if (pthread_create(&indexer, NULL, history_index_thread, NULL) != 0)
+            atomic_store(&index_state, 0);
+    }
+    if (atomic_load(&index_state) == 2)
+        history_index_wait(); // done, the index is the shell's now
+    if (atomic_load(&index_state) != 3)
+        return history_scan(query, nth, len);
+    history_extend();
+    for (i = 0; qlen >= 3 && i + 3 <= qlen; i++)
+    {
+        POSTINGS *p = &buckets[trigram_bucket(query + i)];
+        if (best == NULL || p->len < best->len)
+            best = p;
+    }
+    if (best != NULL)
+    {
+        pos = best->len;
+        id = best->last;
+        more = pos > 0;
+    }
+    else
+    {
+        id = nlines - 1;
+        more = nlines > 0;
+    }
+    while (more)
+    {
+        uint32_t line = id;
+
+        // the next candidate, older
+        if (best != NULL)
+            more = postings_prev(best, &pos, &id) == 0;
+        else
+            more = id-- > 0;
+        if (superseded[line])
+            continue;
+        *len = line_len(line);
+        if (memmem(imap + offs[line], *len, query, qlen) != NULL && nth-- == 0)
+            return imap + offs[line];
+    }
+    return NULL;
+}
+
+/*
+ * @brief Ctrl+R: incremental search of the history through the index
+ *
+ * typing narrows the search, Ctrl+R again goes to the next older match,
+ * Enter runs the match, Ctrl+G gives the line back as it was and any other
+ * key keeps the match in the line and is then handled as usual
+ */
+int history_isearch(int count, int key)
+{
+    char query[256], *saved = strdup(rl_line_buffer);
+    const char *match = NULL, *found;
+    size_t qlen = 0, len = 0, flen;
+    int nth = 0, c;
+
+    query[0] = '\0';
+    for (;;)
+    {
+        rl_message("(reverse-i-search)`%s': %.*s", query, (int)len, match ? match : "");
+        c = rl_read_key();
+        if (c == CTRL('R'))
+        {
+            if (qlen > 0 && (found = history_find(query, nth + 1, &flen)) != NULL)
+            {
+                nth++;
+                match = found;
+                len = flen;
+            }
+            continue;
+        }
+        if (c == CTRL('G') || c == EOF)
+        {
+            rl_replace_line(saved, 0);
+            rl_point = rl_end;
+            break;
+        }
+        if ((c == RUBOUT || c == CTRL('H')) && qlen > 0)
+            query[--qlen] = '\0';
+        else if (isprint(c) && qlen < sizeof(query) - 1)
+        {
+            query[qlen++] = c;
+            query[qlen] = '\0';
+        }
+        else if (c != RUBOUT && c != CTRL('H'))
+        {
+            if (match != NULL)
+            {
+                char *line = strndup(match, len);
+                rl_replace_line(line, 0);
+                rl_point = rl_end;
+                free(line);
+            }
+            if (c == '\n' || c == '\r')
+                rl_newline(1, c);
+            else
+                rl_execute_next(c);
+            break;
+        }
+        nth = 0;
+        match = qlen > 0 ? history_find(query, 0, &len) : NULL;
+        if (match == NULL)
+            len = 0;
+    }
+    rl_clear_message();
+    free(saved);
+    return 0;
+}
+
+/*
+ * @brief history [-n N] [text] - the last N lines (20), or the N most recent distinct ones with text
+ */
+int builtin_history(CMD *cmd, FILE *out)
+{
+    int n = 20, i = 1, k;
+    const char *line, *text, *p, *nl;
+    size_t len;
+
+    if (cmd->argv[i] != NULL && strcmp(cmd->argv[i], "-n") == 0)
+    {
+        if (cmd->argv[i + 1] == NULL || (n = atoi(cmd->argv[i + 1])) <= 0)
+        {
+            fprintf(stderr, "usage: history [-n N] [text]\n");
+            return 2;
+        }
+        i += 2;
+    }
+    text = cmd->argv[i];
+    if (fd == -1)
+        history_init(0); // batch mode
+    if (text != NULL)
+    {
+        for (k = 0; k < n && (line = history_find(text, k, &len)) != NULL; k++)
+            fprintf(out, "%.*s\n", (int)len, line);
+        return k == 0;
+    }
+    if (history_map(&map, &map_size) == -1)
+        return 0;
+    for (p = history_tail(n); p < map + map_size && (nl = memchr(p, '\n', map + map_size - p)) != NULL; p = nl + 1)
+        if (nl > p)
+            fprintf(out, "%.*s\n", (int)(nl - p), p);
+    return 0;
+}
+
+/*
+ * @brief memory taken by the search index (the mapping of the file apart)
+ */
+size_t history_index_bytes()
+{
+    size_t bytes = (size_t)lines_cap * (sizeof(size_t) + 1) + latest_slots * sizeof(uint32_t);
+    int i;
+
+    for (i = 0; buckets != NULL && i < HISTORY_BUCKETS; i++)
+        bytes += sizeof(POSTINGS) + buckets[i].cap;
+    return bytes;
+}
@@ -0,0 +1,334 @@
+/*
+ * @file jobs.c
+ * @brief Background jobs (pipelines ending with &)
+ *
+ * Every background pipeline gets its own process group and an entry in the
+ * job table. SIGCHLD is blocked in every thread and read from a signalfd:
+ * readline calls job_event_hook while it waits for input, and when the
+ * signalfd has something the jobs are reaped with waitpid(WNOHANG). The
+ * finished jobs are reported before the next prompt, like in sh.
+ *
+ * A foreground pipeline stopped by CTRL + Z joins the table as a stopped
+ * job, fg continues it.
+ *
+ * builtins: jobs, wait [%n], fg [%n]
+ */
+
+#include "header.h"
+
+static JOB *jobs = NULL; // id of a job is its position + 1, id 0 = free slot
+static int njobs = 0;
+static int sigchld_fd = -1;
+
+/*
+ * @brief block SIGCHLD and open the signalfd
+ *
+ * must be called before any thread is created, so every thread inherits the mask
+ */
+void jobs_init()
+{
+    sigset_t mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    sigchld_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+/*
+ * @brief exit status as in sh: the code or 128 + signal
+ */
+int exit_status(int status)
+{
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*
+ * @brief text of a pipeline for the job listings
+ * @return malloc'd "cmd args | cmd args"
+ */
+static char *job_describe(CMD *root)
+{
+    size_t len = 1;
+    char *text;
+    CMD *aux;
+    int i;
+
+    for (aux = root; aux != NULL; aux = aux->next)
+        for (i = 0; aux->argv[i] != NULL; i++)
+            len += strlen(aux->argv[i]) + 3;
+    text = malloc(len);
+    text[0] = '\0';
+    for (aux = root; aux != NULL; aux = aux->next)
+    {
+        for (i = 0; aux->argv[i] != NULL; i++)
+        {
+            if (i)
+                strcat(text, " ");
+            strcat(text, aux->argv[i]);
+        }
+        if (aux->next != NULL)
+            strcat(text, " | ");
+    }
+    return text;
+}
+
+/*
+ * @brief new entry of the table
+ * @param CMD* root - pipeline
+ * @param pid_t pgid - process group of the job
+ * @param pid_t* pids - children of the pipeline (-1 once collected), the last one gives the status
+ * @param int n - number of children
+ */
+static JOB *job_new(CMD *root, pid_t pgid, pid_t *pids, int n)
+{
+    JOB *j;
+    int i;
+
+    for (i = 0; i < njobs && jobs[i].id != 0; i++)
+        ;
+    if (i == njobs)
+        jobs = realloc(jobs, ++njobs * sizeof(JOB));
+    j = &jobs[i];
+    j->id = i + 1;
+    j->pgid = pgid;
+    j->pids = malloc(n * sizeof(pid_t));
+    memcpy(j->pids, pids, n * sizeof(pid_t));
+    j->npids = n;
+    for (j->alive = 0, i = 0; i < n; i++)
+        j->alive += pids[i] != -1;
+    j->last = pids[n - 1];
+    j->status = 0;
+    j->stopped = 0;
+    j->cmdline = job_describe(root);
+    return j;
+}
+
+/*
+ * @brief add a background pipeline to the table and print [id] pid
+ */
+void job_add(CMD *root, pid_t pgid, pid_t *pids, int n)
+{
+    JOB *j = job_new(root, pgid, pids, n);
+
+    fprintf(stderr, "[%d] %d\n", j->id, (int)j->last);
+}
+
+/*
+ * @brief add a foreground pipeline stopped by CTRL + Z to the table
+ * @param int status - status of the last stage if it was collected already
+ */
+void job_stop(CMD *root, pid_t pgid, pid_t *pids, int n, int status)
+{
+    JOB *j = job_new(root, pgid, pids, n);
+
+    j->status = status;
+    j->stopped = 1;
+    fprintf(stderr, "\n[%d]+ Stopped\t\t%s\n", j->id, j->cmdline);
+}
+
+static void job_free(JOB *j)
+{
+    free(j->pids);
+    free(j->cmdline);
+    j->id = 0;
+}
+
+/*
+ * @brief collect one child of a job
+ * @param JOB* j - job
+ * @param int k - position of the child in j->pids
+ * @param int options - 0 to block, WNOHANG, or WUNTRACED to return when it stops
+ */
+static void job_waitpid(JOB *j, int k, int options)
+{
+    int status;
+    pid_t r;
+
+    if (j->pids[k] == -1)
+        return;
+    while ((r = waitpid(j->pids[k], &status, options)) == -1 && errno == EINTR)
+        ;
+    if (r == 0)
+        return;
+    if (WIFSTOPPED(status))
+    {
+        j->stopped = 1;
+        return;
+    }
+    if (r == j->last)
+        j->status = exit_status(status);
+    j->pids[k] = -1;
+    j->alive--;
+}
+
+/*
+ * @brief collect the finished children of every job, without blocking
+ *
+ * only does something when SIGCHLD arrived (signalfd readable)
+ */
+void job_reap()
+{
+    struct signalfd_siginfo si;
+    int got = 0, i, k;
+
+    while (sigchld_fd != -1 && read(sigchld_fd, &si, sizeof(si)) == sizeof(si))
+        got = 1;
+    if (!got)
+        return;
+    for (i = 0; i < njobs; i++)
+    {
+        if (jobs[i].id == 0)
+            continue;
+        for (k = 0; k < jobs[i].npids; k++)
+            job_waitpid(&jobs[i], k, WNOHANG);
+    }
+}
+
+/*
+ * @brief readline event hook, called while waiting for input
+ */
+int job_event_hook()
+{
+    job_reap();
+    return 0;
+}
+
+/*
+ * @brief forget the finished jobs, reporting them (before the prompt) if report
+ */
+void job_notify(int report)
+{
+    int i;
+
+    job_reap();
+    for (i = 0; i < njobs; i++)
+    {
+        if (jobs[i].id != 0 && jobs[i].alive == 0)
+        {
+            if (!report)
+                ;
+            else if (jobs[i].status == 0)
+                fprintf(stderr, "[%d]+ Done\t\t%s\n", jobs[i].id, jobs[i].cmdline);
+            else
+                fprintf(stderr, "[%d]+ Exit %d\t\t%s\n", jobs[i].id, jobs[i].status, jobs[i].cmdline);
+            job_free(&jobs[i]);
+        }
+    }
+}
+
+/*
+ * @brief find a job from an argument (%n or n), NULL means the most recent
+ */
+static JOB *job_find(const char *arg)
+{
+    int i, id;
+
+    if (arg == NULL)
+    {
+        for (i = njobs - 1; i >= 0; i--)
+            if (jobs[i].id != 0)
+                return &jobs[i];
+        return NULL;
+    }
+    id = atoi(arg[0] == '%' ? arg + 1 : arg);
+    if (id < 1 || id > njobs || jobs[id - 1].id == 0)
+        return NULL;
+    return &jobs[id - 1];
+}
+
+/*
+ * @brief wait for every child of a job
+ * @param int options - 0, or WUNTRACED to return when one of them stops
+ * @return exit status of the job, 128 + SIGTSTP if it stopped
+ */
+static int job_wait(JOB *j, int options)
+{
+    int k;
+
+    for (k = 0; k < j->npids && !j->stopped; k++)
+        job_waitpid(j, k, options);
+    return j->stopped ? 128 + SIGTSTP : j->status;
+}
+
+/*
+ * @brief jobs - list the background jobs
+ */
+int builtin_jobs(CMD *cmd, FILE *out)
+{
+    int i;
+
+    job_reap();
+    for (i = 0; i < njobs; i++)
+    {
+        if (jobs[i].id == 0)
+            continue;
+        fprintf(out, "[%d] %d %s\t\t%s\n", jobs[i].id, (int)jobs[i].last,
+                jobs[i].alive == 0 ? "Done" : jobs[i].stopped ? "Stopped" : "Running", jobs[i].cmdline);
+        if (jobs[i].alive == 0)
+            job_free(&jobs[i]);
+    }
+    return 0;
+}
+
+/*
+ * @brief wait [%n] - wait for one job or for all of them
+ */
+int builtin_wait(CMD *cmd, FILE *out)
+{
+    JOB *j;
+    int i, status = 0;
+
+    if (cmd->argv[1] == NULL)
+    {
+        for (i = 0; i < njobs; i++)
+        {
+            if (jobs[i].id != 0)
+            {
+                job_wait(&jobs[i], 0);
+                job_free(&jobs[i]);
+            }
+        }
+        return 0;
+    }
+    if ((j = job_find(cmd->argv[1])) == NULL)
+    {
+        fprintf(stderr, "wait: %s: no such job\n", cmd->argv[1]);
+        return 127;
+    }
+    status = job_wait(j, 0);
+    job_free(j);
+    return status;
+}
+
+/*
+ * @brief fg [%n] - bring a job to the foreground and wait for it
+ *
+ * the job gets the terminal while it runs (the shell ignores SIGTTOU to take it back),
+ * CTRL + Z puts it back in the table
+ */
+int builtin_fg(CMD *cmd, FILE *out)
+{
+    JOB *j = job_find(cmd->argv[1]);
+    int status, tty = isatty(0);
+
+    if (j == NULL)
+    {
+        fprintf(stderr, "fg: %s: no such job\n", cmd->argv[1] ? cmd->argv[1] : "current");
+        return 1;
+    }
+    fprintf(out, "%s\n", j->cmdline);
+    fflush(out);
+    if (tty)
+        tcsetpgrp(0, j->pgid);
+    j->stopped = 0;
+    kill(-j->pgid, SIGCONT); // stopped by CTRL + Z, or by SIGTTIN reading the terminal in background
+    status = job_wait(j, tty ? WUNTRACED : 0);
+    if (tty)
+        tcsetpgrp(0, getpgrp());
+    if (j->stopped)
+        fprintf(stderr, "\n[%d]+ Stopped\t\t%s\n", j->id, j->cmdline);
+    else
+        job_free(j);
+    return status;
+}
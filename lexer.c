@@ -0,0 +1,116 @@
+/*
+ * @file lexer.c
+ * @brief Split a command line in tokens
+ *
+ * One pass over the line, the tokens are slices (offset/length) of the line,
+ * nothing is copied. Understands 'single' and "double" quotes, backslash
+ * escapes and the operators | < > 2> & with or without blanks around them
+ * (2> only at the start of a word, like in sh).
+ */
+
+#include "header.h"
+
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || (c) == '\n')
+#define IS_OPERATOR(c) ((c) == '|' || (c) == '<' || (c) == '>' || (c) == '&')
+
+/*
+ * @brief tokenize a line
+ * @param const char* line - input
+ * @param TOKEN* tokens - output, room for strlen(line) + 1 tokens is always enough
+ * @return number of tokens or -1 if a quote is not closed
+ */
+int lex_line(const char *line, TOKEN *tokens)
+{
+    const char *p = line;
+    int n = 0;
+    char quote;
+
+    while (*p)
+    {
+        if (IS_BLANK(*p))
+        {
+            p++;
+            continue;
+        }
+        TOKEN *t = &tokens[n++];
+        t->off = p - line;
+        t->quoted = 0;
+        if (IS_OPERATOR(*p))
+        {
+            t->type = *p == '|' ? TOK_PIPE : *p == '<' ? TOK_IN : *p == '>' ? TOK_OUT : TOK_AMP;
+            t->len = 1;
+            p++;
+            continue;
+        }
+        if (p[0] == '2' && p[1] == '>')
+        {
+            t->type = TOK_ERR;
+            t->len = 2;
+            p += 2;
+            continue;
+        }
+        // word: until a blank or an operator out of quotes
+        t->type = TOK_WORD;
+        while (*p && !IS_BLANK(*p) && !IS_OPERATOR(*p))
+        {
+            if (*p == '\\' && p[1])
+            {
+                t->quoted = 1;
+                p += 2;
+            }
+            else if (*p == '\'' || *p == '"')
+            {
+                t->quoted = 1;
+                quote = *p++;
+                while (*p && *p != quote)
+                    p += (quote == '"' && *p == '\\' && p[1]) ? 2 : 1;
+                if (*p == '\0')
+                    return -1;
+                p++;
+            }
+            else
+                p++;
+        }
+        t->len = (p - line) - t->off;
+    }
+    return n;
+}
+
+/*
+ * @brief remove the quotes and escapes of a word in place
+ * @param char* word - start of the word in the line
+ * @param int len - length of the word
+ * @return the word, now terminated by '\0'
+ *
+ * the result is never longer than the word, so it is written over it
+ */
+char *lex_unquote(char *word, int len)
+{
+    char *in = word, *end = word + len, *out = word;
+    char quote;
+
+    while (in < end)
+    {
+        if (*in == '\\' && in + 1 < end)
+        {
+            *out++ = in[1];
+            in += 2;
+        }
+        else if (*in == '\'' || *in == '"')
+        {
+            quote = *in++;
+            while (in < end && *in != quote)
+            {
+                // inside "" the backslash only escapes " \ $ `
+                if (quote == '"' && *in == '\\' && in + 1 < end && strchr("\"\\$`", in[1]))
+                    in++;
+                *out++ = *in++;
+            }
+            in++;
+        }
+        else
+            *out++ = *in++;
+    }
+    *out = '\0';
+    return word;
+}
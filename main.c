@@ -9,12 +9,14 @@
  * 1 - For the execution of commands with arguments I used the calls to the system fork and the exec family with a dynamic system of pipes 
  *   - To work with files I used the system calls open and dup2
  * 2 - To implement the cd command I used getcwd and chdir
- * 3 - To ignore CTRL + C and + Z I used signals
+ * 3 - CTRL + C and + Z are ignored at the prompt; a foreground pipeline gets its
+ *     own process group and the terminal, CTRL + C in a builtin cancels it
  * 4 - Tab completion for system executables
  *   - Creates word library using threads and deep search 
  *   - second link for details
- * 5 - myls using threads and recursive search
- * 6 - myfind using threads (Producer/Consumer) and recursive search 
+ * 5 - myls, -R on a pool of workers (see myls.c and pool.c)
+ * 6 - myfind on the same pool, every worker reads and matches (see myfind.c)
+ * 7 - batch mode (msh -c "line", msh script or commands from a pipe) without readline
  * 
  * @see www.linkedin.com/in/rafaf10
  * @see https://robots.thoughtbot.com/tab-completion-in-gnu-readline
@@ -24,32 +26,56 @@
 #include "header.h"
 /* SIGNALS */
 sigset_t block_mask;
-/* PTHREAD */
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutexP = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t mutexC = PTHREAD_MUTEX_INITIALIZER;
-pthread_t *dynamic_threads = NULL;
-pthread_t tidC[CONSUMERS]; // consumers threads
-pthread_t tidP; 			// producer thread
-/* SEM */
-sem_t can_prod, // can produce
-	  can_cons; // can consume
 /* VARS */
 char *path = NULL;	// store current path
 char *line; 		// store input
 char **directories = NULL; // store directories from $PATH
-char **dictionary = NULL;  // store executable programs from directories
-static int incremento_dicionario = 0;
+DIRINDEX *dir_index = NULL; // executables of each directory (see cache.c)
 char *string; // $PATH
-char **myfind = NULL;
-static int cnt = 0;
-int prodptr = 0, consptr = 0, nItem = 0;
+int last_status = 0; // exit status of the last command line
+int interactive = 0; // readline loop, job control on the terminal
+atomic_int interrupted; // CTRL + C while the line runs, builtins stop their work
 
 
+/*
+ * @brief SIGINT while a line runs: the builtins poll interrupted
+ */
+static void on_sigint(int sig)
+{
+    atomic_store(&interrupted, 1);
+}
+
+/*
+ * @brief catch SIGINT while a line runs, ignore it at the prompt
+ *
+ * only the interactive shell; in batch mode CTRL + C simply ends the shell
+ */
+static void catch_sigint(int on)
+{
+    struct sigaction sa;
+
+    if (!interactive)
+        return;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on ? on_sigint : SIG_IGN;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+}
+
 int main(int argc, const char *argv[])
 {
-    string = malloc((strlen(getenv("PATH")) + 1) * sizeof(char));
-    strcpy(string, getenv("PATH"));
+    /// builtin stages are threads of the shell: a closed pipe must give EPIPE, not kill it
+    signal(SIGPIPE, SIG_IGN);
+
+    /// children are reaped from a signalfd, before any thread exists
+    jobs_init();
+
+    /// msh -c "line", msh script or stdin not a terminal
+    if (argc > 1 || !isatty(0))
+        return run_batch(argc, argv);
+
+    interactive = 1;
+    string = strdup(getenv("PATH") ? getenv("PATH") : "");
     update_path();
 
     /// Bloqueia CTRL+C e CTRL+Z
@@ -59,50 +85,136 @@ int main(int argc, const char *argv[])
     sa.sa_flags = SA_SIGINFO;    
     sigaction(SIGINT, &sa, &sa_orig_int);
     sigaction(SIGTSTP, &sa, &sa_orig_sigtstp);
+    sigaction(SIGTTOU, &sa, NULL); // to take the terminal back after fg
     
     /// tab completion
     rl_attempted_completion_function = character_name_completion;
-
+    /// words end at the operators of the lexer, quotes are understood
+    rl_completer_word_break_characters = " \t\n|<>&";
+    rl_completer_quote_characters = "'\"";
+    rl_filename_quote_characters = " \t\n\\'\"|<>&";
+    /// background jobs are reaped while waiting for input
+    rl_event_hook = job_event_hook;
+    /// the last lines of ~/.msh_history for the arrows, CTRL+R searches all of it
+    history_init(1);
+
+    /// the executables are indexed in background, the prompt shows up at once
     int sizePath = parse_path();
-    pthread_t tid[sizePath];
-    int index[sizePath], i = 0;
+    pthread_t tidI;
+    dir_index = calloc(sizePath, sizeof(DIRINDEX));
+    pthread_create(&tidI, NULL, &index_path, (void *)(intptr_t)sizePath);
+    pthread_detach(tidI);
 
-    for (i = 0; i < sizePath; i++)
+    while (job_notify(1), (line = readline(path)) != NULL)
     {
-        index[i] = i;
-        pthread_create(&tid[i], NULL, &insert_directories, &index[i]);
+        if (strcmp(line, "") && strcmp(line, " "))
+        {
+            history_add(line);
+            run_line(line);
+        }
+        free(line);
     }
-    for (i = 0; i < sizePath; i++)
+
+    return last_status;
+}
+
+/*
+ * @brief parse and execute one command line
+ * @param char* line - input (modified by the parser)
+ * @return exit status of the line
+ */
+int run_line(char *line)
+{
+    // parse input to root (CMD)
+    CMD *root = parse_line(line);
+    //print_command_list(root);
+    if (root->argv[0] == NULL) // only blanks, or a syntax error (status 2, as in sh)
     {
-        pthread_join(tid[i], NULL);
+        if (root->error)
+            last_status = 2;
+        free_command_list(root);
+        return last_status;
     }
 
-    int my;
-    while (1)
+    atomic_store(&interrupted, 0);
+    catch_sigint(1);
+    BUILTIN *b = builtin_lookup(root->argv[0]);
+    if (b != NULL && root->next == NULL && !root->background) // builtin alone runs without fork
     {
-        line = readline(path);
-        if (strcmp(line, "") && strcmp(line, " "))
+        if (root->timed || options.timing)
         {
-            if (!strcmp(line, "exit"))
-                exit(0);
-            add_history(line);
-            // parse input to root (CMD)
-            CMD *root = parse_line(line);
-            //print_command_list(root);
-            my = strncmp(root->argv[0], "my", 2);
-            if (my != 0)
-                exec_comandos(root);
-            else
-            {
-                myexec(root);
-            }
+            STAGETIME t;
+            struct rusage before;
+
+            timing_begin(&t, root);
+            getrusage(RUSAGE_THREAD, &before);
+            timing_stage = &t; // the pools of the builtin add their workers to it
+            last_status = builtin_run(b, root);
+            timing_stage = NULL;
+            timing_usage(&t, &before);
+            timing_end(&t, last_status);
+            timing_report(&t, 1);
+        }
+        else
+            last_status = builtin_run(b, root);
+    }
+    else
+        last_status = exec_comandos(root);
+    catch_sigint(0);
+
+    free_command_list(root);
+    return last_status;
+}
+
+/*
+ * @brief Point 7 - execute command lines without readline
+ * @return exit status of the last line
+ *
+ * msh -c "line"  - execute the line (it may have several lines)
+ * msh script     - execute every line of the file
+ * msh / msh -    - execute every line of stdin
+ *
+ * no prompt, history nor index of executables; lines are read with getline
+ * from a fully buffered stream, empty lines and lines starting with '#' are skipped
+ */
+int run_batch(int argc, const char *argv[])
+{
+    FILE *fp = stdin;
+    char *buf = NULL, *next, *p;
+    size_t size = 0;
+    ssize_t len;
 
-            free_command_list(root);
-            free(line);
+    if (argc > 2 && strcmp(argv[1], "-c") == 0)
+    {
+        for (p = buf = strdup(argv[2]); p != NULL; p = next)
+        {
+            if ((next = strchr(p, '\n')) != NULL)
+                *next++ = '\0';
+            if (*p != '#')
+                run_line(p);
         }
+        free(buf);
+        return last_status;
     }
+    if (argc > 1 && strcmp(argv[1], "-") != 0 && (fp = fopen(argv[1], "r")) == NULL)
+    {
+        perror(argv[1]);
+        return 127;
+    }
+    setvbuf(fp, NULL, _IOFBF, 1 << 16);
 
-    return 0;
+    while ((len = getline(&buf, &size, fp)) != -1)
+    {
+        if (len > 0 && buf[len - 1] == '\n')
+            buf[len - 1] = '\0';
+        if (buf[0] != '#')
+            run_line(buf);
+        job_notify(0);
+    }
+    free(buf);
+    if (fp != stdin)
+        fclose(fp);
+    return last_status;
 }
 
 /*
@@ -122,61 +234,20 @@ int n_commands(CMD *root)
 }
 
 /*
- * @brief update var path 
+ * @brief update var path (the prompt), its buffer only grows
  */
 void update_path()
 {
-    char pwd[2048];
-    getcwd(pwd, sizeof(pwd));
-    path = malloc((strlen(pwd) + 9) * sizeof(char));
-    strcpy(path, "msh$ ~");
-    strcat(path, pwd);
-    strcat(path, "$ ");
-}
-
-/*
- * @brief store directories
- * @param void* pos - position in directories to use
- */
-void *insert_directories(void *pos)
-{
-    int i = *((int *)pos);
-    DIR *dir;
-    struct dirent *entry;
-    struct stat sb;
-
-    if ((dir = opendir(directories[i])) == NULL)
-        perror("opendir() error");
-    else
-    {
-        char *result = NULL;
-        while ((entry = readdir(dir)) != NULL)
-        {
-            int ponto = strcmp(entry->d_name, ".");
-            int ponto2 = strcmp(entry->d_name, "..");
-
-            if (ponto2 != 0 && ponto != 0)
-            {
-                result = malloc((strlen(directories[i]) + strlen(entry->d_name) + 2) * sizeof(char));
-                strcpy(result, directories[i]);
-                strcat(result, "/");
-                strcat(result, entry->d_name);
-
-                if (stat(result, &sb) == 0 && sb.st_mode & S_IXUSR)
-                {
-                    // CRITICAL AREA
-                    pthread_mutex_lock(&mutex);
-                    dictionary = realloc(dictionary, (incremento_dicionario + 1) * sizeof(char **));
-                    dictionary[incremento_dicionario] = (char *)malloc((strlen(entry->d_name) + 1) * sizeof(char));
-                    strcpy(dictionary[incremento_dicionario], entry->d_name);
-                    incremento_dicionario++;
-                    pthread_mutex_unlock(&mutex);
-                    // END OF CRITICAL AREA
-                }
-            }
-        }
-    }
-    closedir(dir);
+    static size_t size = 0;
+    char pwd[PATH_MAX];
+    size_t len;
+
+    if (getcwd(pwd, sizeof(pwd)) == NULL)
+        strcpy(pwd, "?");
+    len = strlen(pwd) + 9;
+    if (len > size)
+        path = realloc(path, size = len);
+    snprintf(path, size, "msh$ ~%s$ ", pwd);
 }
 
 /*
@@ -186,7 +257,7 @@ void *insert_directories(void *pos)
 int parse_path()
 {
     char *a;
-    int n = 0, j = 0;
+    int n = 0;
 
     a = strtok(string, ":");
     for (n = 0; a; n++)
@@ -205,499 +276,182 @@ int parse_path()
  * @brief Point 1 and 2
  * 
  * 1 - count commands
- *   - create pipes
- *   - create processes
+ *   - create the pipe of each stage (O_CLOEXEC, size from 'set pipesize')
+ *   - create processes (posix_spawn, see spawn.c)
  * 		- work with previous pipe or stdin or files
  * 		- write (execute) to the pipe or stdout or files
  * 
- * 2 - check if first argument is cd
- * 	 - check if have destination
- * 	 - chande directory and update path var
+ * 2 - builtins in a pipeline (see builtin.c) run in a thread of the shell
+ *     (myls, myfind, echo...) or in a forked child (cd, exit, set)
+ * 
+ * 3 - pipeline starting with time (or set timing on) is accounted, see timing.c
+ * 
+ * 4 - pipeline ending with & goes to the job table (see jobs.c) without waiting
  * 
+ * 5 - in the interactive shell the children of a foreground pipeline get a
+ *     process group of their own and the terminal, so CTRL + C reaches them
+ *     and not the shell; one of them killed by SIGINT cancels the builtin
+ *     threads of the pipeline too; CTRL + Z stops them and the pipeline goes
+ *     to the job table (fg continues it), unless a stage runs in a thread
+ * 
+ * @return exit status of the last command of the pipeline
  */
-void exec_comandos(CMD *root)
+int exec_comandos(CMD *root)
 {
-    if (strcmp(root->argv[0], "cd") == 0)
-    {
-        if (root->argv[1] == NULL)
-        {
-            chdir("/");
-        }
-        else
-        {
-            chdir(root->argv[1]);
-        }
-        update_path();
-        return;
-    }
     int nComandos = n_commands(root);
-    int i, fp, status = 0;
-    int fds[2 * nComandos];
+    int i, status = 0, last = 0, failed;
+    int fds[2], in = -1, out, next_in;
     CMD *aux = root;
-    pid_t pid, wpid;
+    char *prog;
+    pid_t pid = -1, pgid = 0;
+    pid_t *group = root->background || interactive ? &pgid : NULL;
+    int terminal = 0; // the group of the children has the terminal
+    pid_t pids[nComandos]; // children to wait for
+    int pidstage[nComandos], npids = 0, left, stopped = 0;
+    BUILTIN *b;
+    STAGE stages[nComandos];
+    int nstages = 0, thread_last = 0;
+    STAGETIME times[nComandos];
+    int timed = (root->timed || options.timing) && !root->background;
 
-    // create n pipes
-    for (i = 0; i < nComandos - 1; i++)
-    {
-        if (pipe(fds + i * 2) < 0)
-        {
-            perror("pipe(fds)");
-            exit(1);
-        }
-    }
 	// Execute
     i = 0;
     while (aux != NULL)
     {
-        pid = fork();
-        if (pid < 0)
+        // only the pipe of this stage is open: O_CLOEXEC, so each child keeps just its two ends
+        out = -1;
+        if (i != nComandos - 1)
         {
-            perror("pid");
-            exit(1);
+            if (pipe2(fds, O_CLOEXEC) < 0)
+            {
+                perror("pipe(fds)");
+                break;
+            }
+            if (options.pipesize > 0)
+                fcntl(fds[1], F_SETPIPE_SZ, options.pipesize);
+            out = fds[1];
         }
-        if (pid == 0)
+        next_in = out != -1 ? fds[0] : -1; // the next stage reads from the current pipe
+        if (timed)
+            timing_begin(&times[i], aux);
+        failed = 0;
+        b = builtin_lookup(aux->argv[0]);
+        if (b != NULL && (b->flags & BUILTIN_THREAD) && aux->errfile == NULL && !root->background)
         {
-            if (i != 0) // Read from the previous pipe (if it is not the first one)
+            // in-process stage, the thread takes in and out
+            stages[nstages].b = b;
+            stages[nstages].cmd = aux;
+            stages[nstages].time = timed ? &times[i] : NULL;
+            pid = -1;
+            if (stage_start(&stages[nstages], in, out) == 0)
             {
-                dup2(fds[(i - 1) * 2], 0); // i - 1 (=) previous pipe (reading)
+                thread_last = i == nComandos - 1;
+                nstages++;
             }
-            if (i != nComandos - 1) // Write to the pipe (if not the last one)
+            else
+                failed = 1;
+        }
+        else
+        {
+            if (b != NULL)
             {
-                dup2(fds[i * 2 + 1], 1); // current pipe (written)
+                pid = spawn_builtin(b, aux, in, out, group);
+                failed = pid == -1;
             }
-            if (aux->infile != NULL)
-            {
-                fp = open(aux->infile, O_RDONLY, 0400); // owner read
-                if (fp == -1)
-                {
-                    perror("File not existent");
-                    exit(1);
-                }
-                dup2(fp, 0);
-                close(fp);
-            }
-            if (aux->outfile != NULL)
+            else
             {
-                fp = open(aux->outfile, O_WRONLY | O_TRUNC | O_CREAT, 0200); // owner write
-                if (fp == -1)
-                {
-                    perror("Error creating file");
-                    exit(1);
-                }
-                dup2(fp, 1);
-                close(fp);
+                prog = hash_lookup(aux->argv[0]); // resolved once, the child does not search $PATH
+                pid = spawn_command(aux, prog, in, out, group);
+                if (pid == -1)
+                    failed = prog == NULL ? 127 : 1;
             }
-            if (aux->errfile != NULL)
+            if (pid > 0)
             {
-                fp = open(aux->errfile, O_WRONLY | O_TRUNC | O_CREAT, 0200); // owner write
-                if (fp == -1)
+                pidstage[npids] = i;
+                pids[npids++] = pid;
+                if (timed)
+                    times[i].pid = pid;
+                if (interactive && !root->background && !terminal)
                 {
-                    perror("Error creating file");
-                    exit(1);
+                    tcsetpgrp(0, pgid);
+                    kill(-pgid, SIGCONT); // stopped by SIGTTIN if it read the terminal before
+                    terminal = 1;
                 }
-                dup2(fp, 2);
-                close(fp);
             }
-            execvp(aux->argv[0], aux->argv);
-            perror("execvp");
-            exit(1);
-        }
-        if (i != 0)
-        {
-            close(fds[((i - 1) * 2)]);
+            if (in != -1) // previous pipe (reading) belongs to this stage now
+                close(in);
+            if (out != -1)
+                close(out);
         }
-        if (i != nComandos - 1)
+        if (failed)
         {
-            close(fds[i * 2 + 1]);
+            if (i == nComandos - 1)
+                last = failed;
+            if (timed)
+                timing_end(&times[i], failed);
         }
+        in = next_in;
         aux = aux->next;
         i++;
     }
-    while (wait(&status) > 0)
-        ;
-}
-
-/*
- * @brief Point 5 and 6
- * 
- * 5 - check parameters (-a, -l, -al, -R)
- *   - check path
- *     - use path or get current path
- *   - open the directory and print
- * 6 - get current path
- * 	 - create consumers and producers 
- * 
- */
-void myexec(CMD *root)
-{
-    if (strcmp(root->argv[0], "myls") == 0)
+    if (aux != NULL && in != -1)
+        close(in);
+    if (root->background) // see jobs.c
     {
-        DIR *dir;
-        struct dirent *entry;
-        struct stat sb;
-        char pwd[2024] = "\0";
-        int param[2] = {0};
-        CMD *aux = root;
-
-        int i = 1, p = 0, a, l, al, r;
-        // check parameters 
-        while (aux->argv[i] != NULL)
-        {
-            a = strcmp(aux->argv[i], "-a");
-            l = strcmp(aux->argv[i], "-l");
-            al = strcmp(aux->argv[i], "-al");
-            r = strcmp(aux->argv[i], "-R");
-            if (l == 0) // -l
-            {
-                param[0] = 1;
-            }
-            else if (a == 0) // -a
-            {
-                param[1] = 1;
-            }
-            else if (al == 0) // -al
-            {
-                param[0] = 1;
-                param[1] = 1;
-            }
-            else if (r == 0) // -R
-            {
-                param[2] = 1;
-            }
-            else
-            {
-                p++;
-                strcpy(pwd, aux->argv[i]);
-            }
-            i++;
-        }
-
-        if (p == 0) // no path given
-        {
-            getcwd(pwd, sizeof(pwd));
-        }
-
-        char *aux_pwd = malloc((strlen(pwd) + 1) * sizeof(char));
-        strcpy(aux_pwd, pwd);
-        
-        if ((dir = opendir(pwd)) == NULL)
-            perror("opendir() error");
-        else
-        {
-            char *result = NULL;
-            while ((entry = readdir(dir)) != NULL)
-            {
-
-                result = malloc((strlen(pwd) + strlen(entry->d_name) + 2) * sizeof(char));
-                strcpy(result, pwd);
-                strcat(result, "/");
-                strcat(result, entry->d_name);
-
-                if (stat(result, &sb) == 0)
-                {
-                    if (param[0] == 1 && param[1] == 1)
-                    { // -al
-                        struct passwd *pw = getpwuid(sb.st_uid);
-                        struct group *gr = getgrgid(sb.st_gid);
-
-                        printf((sb.st_mode & S_IFDIR) ? "d" : "-");
-                        printf((sb.st_mode & S_IRUSR) ? "r" : "-");
-                        printf((sb.st_mode & S_IWUSR) ? "w" : "-");
-                        printf((sb.st_mode & S_IXUSR) ? "x" : "-");
-                        printf((sb.st_mode & S_IRGRP) ? "r" : "-");
-                        printf((sb.st_mode & S_IWGRP) ? "w" : "-");
-                        printf((sb.st_mode & S_IXGRP) ? "x" : "-");
-                        printf((sb.st_mode & S_IROTH) ? "r" : "-");
-                        printf((sb.st_mode & S_IWOTH) ? "w" : "-");
-                        printf((sb.st_mode & S_IXOTH) ? "x" : "-");
-                        printf(" %s", pw->pw_name);
-                        printf(" %s", gr->gr_name);
-                        if (strncmp(entry->d_name, ".", 1) == 0 || strncmp(entry->d_name, "..", 2) == 0)
-                            printf(" %s %s %s ", VERMELHO, entry->d_name, BRANCO);
-                        else if (sb.st_mode & S_IFDIR)
-                            printf(" %s %s %s", BRANCO, entry->d_name, BRANCO);
-                        else if (sb.st_mode & S_IXUSR)
-                            printf(" %s %s %s   ", VERDE, entry->d_name, BRANCO);
-                        printf("\n");
-                    }
-                    else if (param[0] == 1)
-                    { // -l
-                        struct passwd *pw = getpwuid(sb.st_uid);
-                        struct group *gr = getgrgid(sb.st_gid);
-                        if (sb.st_mode & S_IFDIR)
-                            ;
-                        else if (sb.st_mode & S_IXUSR)
-                        {
-                            printf((sb.st_mode & S_IFDIR) ? "d" : "-");
-                            printf((sb.st_mode & S_IRUSR) ? "r" : "-");
-                            printf((sb.st_mode & S_IWUSR) ? "w" : "-");
-                            printf((sb.st_mode & S_IXUSR) ? "x" : "-");
-                            printf((sb.st_mode & S_IRGRP) ? "r" : "-");
-                            printf((sb.st_mode & S_IWGRP) ? "w" : "-");
-                            printf((sb.st_mode & S_IXGRP) ? "x" : "-");
-                            printf((sb.st_mode & S_IROTH) ? "r" : "-");
-                            printf((sb.st_mode & S_IWOTH) ? "w" : "-");
-                            printf((sb.st_mode & S_IXOTH) ? "x" : "-");
-                            printf(" %s", pw->pw_name);
-                            printf(" %s", gr->gr_name);
-                            printf(" %s %s %s   ", VERDE, entry->d_name, BRANCO);
-                            printf("\n");
-                        }
-                    }
-                    else if (param[1] == 1)
-                    { // -a
-                        if (strncmp(entry->d_name, ".", 1) == 0 || strncmp(entry->d_name, "..", 2) == 0)
-                            printf(" %s %s %s ", VERMELHO, entry->d_name, BRANCO);
-                        else if (sb.st_mode & S_IFDIR)
-                            printf("%s %s %s", BRANCO, entry->d_name, BRANCO);
-                        else if (sb.st_mode & S_IXUSR)
-                            printf("%s %s %s   ", VERDE, entry->d_name, BRANCO);
-                        else if (sb.st_mode & S_IFLNK)
-                            printf("%s %s %s   ", CYAN, entry->d_name, BRANCO);
-                    }
-                    else if (param[2] == 1)
-                    {
-                        //-R
-                        if (sb.st_mode)
-                        {
-                            cnt = 0;
-                            free(dynamic_threads);
-                            dynamic_threads = NULL;
-                            dynamic_threads = realloc(dynamic_threads, (cnt + 1) * sizeof(pthread_t));
-                            pthread_create(&dynamic_threads[cnt], NULL, list_dir, aux_pwd);
-                            int c = 0;
-                            for (c = 0; c <= cnt; c++)
-                            {
-                                pthread_join(dynamic_threads[c], NULL);
-                            }
-                            printf("\n");
-                            closedir(dir);
-                            return;
-                        }
-                    }
-                    else
-                    {
-                        if (strncmp(entry->d_name, ".", 1) != 0 && strncmp(entry->d_name, "..", 2) != 0)
-                        {
-                            if (sb.st_mode & S_IFDIR)
-                                printf("%s %s %s", AZUL, entry->d_name, BRANCO);
-                            else if (sb.st_mode & S_IXUSR)
-                                printf("%s %s %s   ", VERDE, entry->d_name, BRANCO);
-                            else if (sb.st_mode & S_IFLNK)
-                                printf("%s %s %s   ", CYAN, entry->d_name, BRANCO);
-                        }
-                    }
-                }
-            }
-            printf("\n");
-            closedir(dir);
-        }
+        if (npids > 0)
+            job_add(root, pgid, pids, npids);
+        return 0;
     }
-    else if (strcmp(root->argv[0], "myfind") == 0)
+    // only the children of this pipeline (their process group, background
+    // jobs have their own), collected as they exit so each stage ends on time
+    for (left = npids; left > 0 && !stopped; )
     {
-        char pwd[2024] = "\0";
-        getcwd(pwd, sizeof(pwd));
-        char *aux_pwd = malloc((strlen(pwd) + 1) * sizeof(char));
-        strcpy(aux_pwd, pwd);
-
-        sem_init(&can_cons, 0, 1);
-        sem_init(&can_prod, 0, N - 1);
-
-        int i;
-        cnt = prodptr = consptr = nItem = 0;
+        struct rusage ru;
+        pid_t r = wait4(group != NULL ? -pgid : -getpgrp(), &status, terminal ? WUNTRACED : 0, &ru);
 
-        myfind = realloc(myfind, N * sizeof(char **));
-
-        myfind[prodptr] = malloc((strlen(aux_pwd) + 2) * sizeof(char));
-        strcpy(myfind[prodptr], aux_pwd);
-        nItem++;
-        prodptr = (prodptr + 1) % N;
-
-        pthread_create(&tidP, NULL, &produtor, aux_pwd);
-        for (i = 0; i < CONSUMERS; i++)
-        {
-            pthread_create(&tidC[i], NULL, &consumidor, (void *)root->argv[1]);
-        }
-        pthread_join(tidP, NULL);
-
-        for (i = 0; i < CONSUMERS; i++)
+        if (r == -1)
         {
-            pthread_join(tidC[i], NULL);
+            if (errno == EINTR)
+                continue;
+            break;
         }
-
-        printf("\n");
-        return;
-    }
-}
-
-/*
- * @brief print directories (file names) recursively - myls -R
- * @param void* name - directory to use
- * @return next directory
- * 
- * browse the directory and print the files
- * whenever it finds another directory create new task with directory as parameter
- */
-void *list_dir(void *name)
-{
-    char *diretorio = strdup(name);
-
-    DIR *dir;
-    struct dirent *entry;
-
-    if (!(dir = opendir(diretorio)))
-        return;
-
-    printf("\n%s: \n", diretorio);
-    while ((entry = readdir(dir)) != NULL)
-    {
-        if (strncmp(entry->d_name, ".", 1) != 0 && strncmp(entry->d_name, "..", 2) != 0)
+        for (i = 0; i < npids && pids[i] != r; i++)
+            ;
+        if (i == npids)
+            continue;
+        if (WIFSTOPPED(status))
         {
-            if (entry->d_type == DT_DIR)
-            {
-                char *path = NULL;
-                path = malloc((strlen(diretorio) + strlen(entry->d_name) + 2) * sizeof(char));
-                strcpy(path, diretorio);
-                strcat(path, "/");
-                strcat(path, entry->d_name);
-                printf(" %s %s %s", AZUL, entry->d_name, BRANCO);
-                // CRITICAL AREA
-                pthread_mutex_lock(&mutex);
-                cnt++;
-                dynamic_threads = realloc(dynamic_threads, (cnt + 1) * sizeof(pthread_t));
-                pthread_create(&dynamic_threads[cnt], NULL, &list_dir, path);
-                pthread_mutex_unlock(&mutex);
-                // END OF CRITICAL AREA
-            }
+            // the builtin threads of the shell cannot be put aside with the children
+            if (nstages > 0)
+                kill(-pgid, SIGCONT);
             else
-            {
-                printf(" %s %s %s   ", VERDE, entry->d_name, BRANCO);
-            }
+                stopped = 1;
+            continue;
         }
-    }
-    printf("\n");
-    closedir(dir);
-}
-
-/*
- * @brief save directories in myfind[] recursively
- * @param void* name - directory to use
- * @return next directory
- */
-void *produtor(void *name)
-{
-    char *diretorio = strdup(name);
-
-    DIR *dir;
-    struct dirent *entry;
-
-    if (!(dir = opendir(diretorio)))
-        return;
-
-    while ((entry = readdir(dir)) != NULL)
-    {
-        if (strncmp(entry->d_name, ".", 1) != 0 && strncmp(entry->d_name, "..", 2) != 0)
+        pids[i] = -1; // collected
+        left--;
+        if (timed)
         {
-            if (entry->d_type == DT_DIR)
-            {
-                sem_wait(&can_prod);
-                pthread_mutex_lock(&mutexP);
-                myfind[prodptr] = malloc((strlen(diretorio) + strlen(entry->d_name) + 2) * sizeof(char));
-                strcpy(myfind[prodptr], diretorio);
-                strcat(myfind[prodptr], "/");
-                strcat(myfind[prodptr], entry->d_name);
-                int aux = prodptr;
-                prodptr = (prodptr + 1) % N; // to cycle from 0 to N
-                nItem++;
-                pthread_mutex_unlock(&mutexP);
-                sem_post(&can_cons);
-                produtor(myfind[aux]);
-            }
+            times[pidstage[i]].ru = ru;
+            timing_end(&times[pidstage[i]], exit_status(status));
         }
+        if (r == pid) // last command of the pipeline
+            last = exit_status(status);
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+            atomic_store(&interrupted, 1); // CTRL + C went to the children only
     }
-    closedir(dir);
-}
-
-/*
- * @brief search the file in the directories array (myfind[])
- * @param void* name - file to search
- * - while there are directories to process
- *   - open the directory and search the file
- */
-void *consumidor(void *name)
-{
-    char *fn; // file name
-    fn = (char *)name;
-    DIR *dir;
-    struct dirent *entry;
-
-    int aux = 0;
-    while (nItem != 0)
+    if (terminal)
+        tcsetpgrp(0, getpgrp());
+    if (stopped)
     {
-        sem_wait(&can_cons);
-        pthread_mutex_lock(&mutexC);
-        char *diretorio = malloc((strlen(myfind[consptr]) + 1) * sizeof(char));
-        strcpy(diretorio, myfind[consptr]);
-        if (!(dir = opendir(diretorio)))
-            return;
-        while ((entry = readdir(dir)) != NULL)
-        {
-            if (strncmp(entry->d_name, ".", 1) != 0 && strncmp(entry->d_name, "..", 2) != 0)
-            {
-                if (fn == NULL)
-                {
-                    printf("\n ./%s", entry->d_name);
-                }
-                else if (strcmp(entry->d_name, fn) == 0)
-                {
-                    printf("\n %s", diretorio);
-                    printf("\n ./%s", entry->d_name);
-                }
-            }
-        }
-        closedir(dir);
-        consptr = (consptr + 1) % N;
-        nItem--;
-        pthread_mutex_unlock(&mutexC);
-        sem_post(&can_prod);
+        job_stop(root, pgid, pids, npids, last);
+        return 128 + WSTOPSIG(status);
     }
-}
-
-
-/*
- * @brief Point 3
- * See second link
- */
-char **
-character_name_completion(const char *text, int start, int end)
-{
-    rl_attempted_completion_over = 1;
-    return rl_completion_matches(text, character_name_generator);
-}
-
-/*
- * @brief Point 3
- * See second link
- */
-char *
-character_name_generator(const char *text, int state)
-{
-    static int list_index, len;
-    char *name;
-
-    if (!state)
-    {
-        list_index = 0;
-        len = strlen(text);
-    }
-
-    while ((name = dictionary[list_index++]))
-    {
-        if (strncmp(name, text, len) == 0)
-        {
-            return strdup(name);
-        }
-    }
-
-    return NULL;
+    for (i = 0; i < nstages; i++)
+        pthread_join(stages[i].tid, NULL);
+    if (thread_last)
+        last = stages[nstages - 1].status;
+    if (timed && aux == NULL) // not when a pipe could not be created
+        timing_report(times, nComandos);
+    return last;
 }
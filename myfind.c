@@ -0,0 +1,587 @@
+/*
+ * @file myfind.c
+ * @brief myfind builtin: parallel search of a directory tree
+ *
+ * Every directory is a task of a pool (pool.c): the worker that takes it
+ * reads it, writes the entries that match and submits the subdirectories
+ * it finds, so every worker both discovers and matches and the deques
+ * balance the load. The pool knows when the last directory is done.
+ *
+ * The matches of a directory are gathered in a buffer of the worker and
+ * handed to the output in one fwrite(), which locks the FILE, so lines of
+ * different workers never mix. The order of the lines depends on the
+ * workers, as find gives no order either.
+ *
+ * The predicates are all to be true (find's implicit -a). They are tried
+ * from the cheapest: the name (a glob compiled to a plain comparison when
+ * it can), the type from d_type, and only then -size and -mtime, which need
+ * one statx() of the entry asking just for what they use. -maxdepth and
+ * -prune act before a directory is submitted, so its subtree is never read.
+ */
+
+#include "header.h"
+
+#define FIND_BUF 16384
+
+#define GLOB_ALL 0    // *
+#define GLOB_EXACT 1  // no wildcard
+#define GLOB_PREFIX 2 // abc*
+#define GLOB_SUFFIX 3 // *.c
+#define GLOB_FULL 4   // anything else, fnmatch()
+
+/* -name, -iname or -prune pattern, see glob_compile() */
+typedef struct glob {
+    const char *pat;
+    size_t len;  // of the literal part for EXACT, PREFIX and SUFFIX
+    int kind;    // GLOB_*
+    int icase;
+} GLOB;
+
+#define FIND_WALK 0
+#define FIND_INDEX 1  // --index: build or refresh the database of the path
+#define FIND_LOCATE 2 // --locate: answer from that database
+
+/* predicates of a myfind */
+typedef struct find_expr {
+    GLOB name;
+    int has_name;
+    unsigned int types;  // 1 << DT_* accepted, 0 = any
+    int size_cmp;        // -1, 0, 1 for -N, N, +N; 2 = no -size
+    long long size;      // in units
+    long long unit;      // bytes of a unit
+    int mtime_cmp;       // as size_cmp
+    long long mtime;     // days
+    int maxdepth;        // -1 = no limit
+    long limit;          // -limit N (-quit is 1), 0 = all the matches
+    GLOB prune[8];
+    int nprune;
+    time_t now;
+} FINDEXPR;
+
+/* directory to read */
+typedef struct find_dir {
+    int depth;
+    char path[];
+} FINDDIR;
+
+/* state shared by the workers of a myfind */
+typedef struct find_walk {
+    FINDEXPR e;
+    FILE *out;
+    atomic_int cancel; // nothing more is read: limit reached, output failed, CTRL + C
+    atomic_int failed; // the output failed
+    atomic_long found; // matches taken, for -limit
+} FINDWALK;
+
+/* lines of a worker, written in one block */
+typedef struct find_out {
+    char data[FIND_BUF];
+    size_t len;
+} FINDOUT;
+
+/* --locate */
+typedef struct find_locate {
+    FINDEXPR *e;
+    const char *start; // printed before the paths of the index
+    FILE *out;
+    long found;
+} FINDLOCATE;
+
+static int has_wildcard(const char *s, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\')
+            return 1;
+    return 0;
+}
+
+/*
+ * @brief sort a pattern into the cheapest way to match it
+ */
+static void glob_compile(GLOB *g, const char *pat, int icase)
+{
+    size_t n = strlen(pat);
+
+    g->pat = pat;
+    g->icase = icase;
+    g->len = n;
+    if (strcmp(pat, "*") == 0)
+        g->kind = GLOB_ALL;
+    else if (!has_wildcard(pat, n))
+        g->kind = GLOB_EXACT;
+    else if (pat[n - 1] == '*' && !has_wildcard(pat, n - 1))
+    {
+        g->kind = GLOB_PREFIX;
+        g->len = n - 1;
+    }
+    else if (pat[0] == '*' && !has_wildcard(pat + 1, n - 1))
+    {
+        g->kind = GLOB_SUFFIX;
+        g->pat = pat + 1;
+        g->len = n - 1;
+    }
+    else
+        g->kind = GLOB_FULL;
+}
+
+static int glob_match(GLOB *g, const char *name)
+{
+    size_t n;
+
+    switch (g->kind)
+    {
+    case GLOB_ALL:
+        return 1;
+    case GLOB_EXACT:
+        return g->icase ? strcasecmp(name, g->pat) == 0 : strcmp(name, g->pat) == 0;
+    case GLOB_PREFIX:
+        return g->icase ? strncasecmp(name, g->pat, g->len) == 0 : strncmp(name, g->pat, g->len) == 0;
+    case GLOB_SUFFIX:
+        n = strlen(name);
+        if (n < g->len)
+            return 0;
+        return g->icase ? strcasecmp(name + n - g->len, g->pat) == 0 : memcmp(name + n - g->len, g->pat, g->len) == 0;
+    default:
+        return fnmatch(g->pat, name, (g->icase ? FNM_CASEFOLD : 0)) == 0;
+    }
+}
+
+/*
+ * @brief [+-]N, with an optional unit suffix when units is given
+ * @return 0 or -1 if the number is not valid
+ */
+static int parse_number(const char *arg, int *cmp, long long *value, long long *unit, const char *units)
+{
+    char *end;
+
+    *cmp = *arg == '+' ? 1 : *arg == '-' ? -1 : 0;
+    if (*cmp != 0)
+        arg++;
+    if (!isdigit((unsigned char)*arg))
+        return -1;
+    *value = strtoll(arg, &end, 10);
+    if (units == NULL)
+        return *end == '\0' ? 0 : -1;
+    if (*end == '\0')
+        *unit = 512; // find counts in blocks of 512 bytes
+    else if (end[1] != '\0' || strchr(units, *end) == NULL)
+        return -1;
+    else
+        *unit = *end == 'c' ? 1 : *end == 'k' ? 1024 : *end == 'M' ? 1 << 20 : 1 << 30;
+    return 0;
+}
+
+static int compare(long long have, int cmp, long long want)
+{
+    return cmp > 0 ? have > want : cmp < 0 ? have < want : have == want;
+}
+
+/*
+ * @brief the predicates that only need the name and the type
+ * @return 1 if the entry may match, the statx() ones still to be checked
+ */
+static int find_cheap(FINDEXPR *e, const char *name, unsigned char type)
+{
+    if (e->has_name && !glob_match(&e->name, name))
+        return 0;
+    if (e->types && !(e->types & (1u << type)))
+        return 0;
+    return 1;
+}
+
+/*
+ * @brief -size and -mtime, with one statx() asking for what they use
+ */
+static int find_stat(FINDEXPR *e, int dfd, const char *name)
+{
+    unsigned int mask = 0;
+    struct statx stx;
+
+    if (e->size_cmp != 2)
+        mask |= STATX_SIZE;
+    if (e->mtime_cmp != 2)
+        mask |= STATX_MTIME;
+    if (mask == 0)
+        return 1;
+    if (statx(dfd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) == -1)
+        return 0;
+    if (e->size_cmp != 2 && !compare(((long long)stx.stx_size + e->unit - 1) / e->unit, e->size_cmp, e->size))
+        return 0;
+    if (e->mtime_cmp != 2 && !compare((e->now - (long long)stx.stx_mtime.tv_sec) / 86400, e->mtime_cmp, e->mtime))
+        return 0;
+    return 1;
+}
+
+static int find_pruned(FINDEXPR *e, const char *name)
+{
+    int i;
+
+    for (i = 0; i < e->nprune; i++)
+        if (glob_match(&e->prune[i], name))
+            return 1;
+    return 0;
+}
+
+/*
+ * @brief parent/name, or just parent when name is NULL (the start)
+ */
+static FINDDIR *find_dir_new(const char *parent, size_t plen, const char *name, int depth)
+{
+    size_t nlen = name != NULL ? strlen(name) : 0;
+    FINDDIR *d = malloc(sizeof(FINDDIR) + plen + nlen + 2);
+
+    d->depth = depth;
+    memcpy(d->path, parent, plen);
+    if (name != NULL)
+        d->path[plen++] = '/';
+    memcpy(d->path + plen, name != NULL ? name : "", nlen + 1);
+    return d;
+}
+
+static void find_flush(FINDWALK *w, FINDOUT *o)
+{
+    if (o->len > 0 && !atomic_load(&w->failed))
+    {
+        fwrite(o->data, 1, o->len, w->out);
+        if (ferror(w->out))
+        {
+            atomic_store(&w->failed, 1);
+            atomic_store(&w->cancel, 1);
+        }
+    }
+    o->len = 0;
+}
+
+/*
+ * @brief a match may be printed, -limit allowing
+ *
+ * every match takes a number, the walk is cancelled by the one that takes
+ * the last, so exactly limit lines are printed whatever the workers do
+ */
+static int find_take(FINDWALK *w)
+{
+    long k;
+
+    if (w->e.limit == 0)
+        return 1;
+    k = atomic_fetch_add(&w->found, 1);
+    if (k + 1 >= w->e.limit)
+        atomic_store(&w->cancel, 1);
+    return k < w->e.limit;
+}
+
+/*
+ * @brief add parent/name to the lines of the worker
+ */
+static void find_print(FINDWALK *w, FINDOUT *o, const char *parent, size_t plen, const char *name)
+{
+    size_t nlen = strlen(name);
+
+    if (o->len + plen + nlen + 2 > FIND_BUF)
+        find_flush(w, o);
+    if (plen + nlen + 2 > FIND_BUF) // longer than the buffer, on its own
+    {
+        flockfile(w->out);
+        fprintf(w->out, "%.*s/%s\n", (int)plen, parent, name);
+        funlockfile(w->out);
+        return;
+    }
+    memcpy(o->data + o->len, parent, plen);
+    o->data[o->len + plen] = '/';
+    memcpy(o->data + o->len + plen + 1, name, nlen);
+    o->data[o->len + plen + nlen + 1] = '\n';
+    o->len += plen + nlen + 2;
+}
+
+/*
+ * @brief task of a worker: one directory
+ */
+static void find_task(POOL *p, int worker, void *task)
+{
+    FINDWALK *w = pool_context(p);
+    FINDDIR *d = task;
+    size_t plen = strlen(d->path);
+    FINDOUT *o = malloc(sizeof(FINDOUT));
+    struct dirent64 *entry;
+    struct stat sb;
+    DIRREAD dir;
+
+    if (plen > 0 && d->path[plen - 1] == '/') // the start, "/" or "dir/": no "//" in the paths
+        plen--;
+    o->len = 0;
+    if (atomic_load(&w->cancel) || atomic_load(&interrupted) || dir_open(&dir, AT_FDCWD, d->path) == -1)
+    {
+        if (!atomic_load(&w->cancel) && !atomic_load(&interrupted))
+            fprintf(stderr, "myfind: %s: %s\n", d->path, strerror(errno));
+        free(o);
+        free(d);
+        return;
+    }
+    while ((entry = dir_next(&dir)) != NULL)
+    {
+        const char *name = entry->d_name;
+        unsigned char type = entry->d_type;
+
+        if (atomic_load(&w->cancel) || atomic_load(&interrupted))
+            break;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+            continue;
+        if (type == DT_UNKNOWN && fstatat(dir.fd, name, &sb, AT_SYMLINK_NOFOLLOW) == 0)
+            type = IFTODT(sb.st_mode);
+        if (type == DT_DIR && find_pruned(&w->e, name))
+            continue; // neither printed nor read
+        if (find_cheap(&w->e, name, type) && find_stat(&w->e, dir.fd, name) && find_take(w))
+            find_print(w, o, d->path, plen, name);
+        if (type == DT_DIR && (w->e.maxdepth < 0 || d->depth + 1 < w->e.maxdepth))
+            pool_submit(p, worker, find_dir_new(d->path, plen, name, d->depth + 1));
+    }
+    dir_close(&dir);
+    find_flush(w, o);
+    free(o);
+    free(d);
+}
+
+/*
+ * @brief parse the arguments of myfind
+ * @return 0 or -1 (error printed)
+ */
+static int find_parse(CMD *root, FINDEXPR *e, const char **start, int *jobs, int *mode)
+{
+    char **argv = root->argv;
+    const char *bare = NULL;
+    struct stat sb;
+    int i, j;
+
+    memset(e, 0, sizeof(FINDEXPR));
+    e->size_cmp = e->mtime_cmp = 2;
+    e->maxdepth = -1;
+    e->now = time(NULL);
+    for (i = 1; argv[i] != NULL; i++)
+    {
+        char *arg = argv[i], *val = argv[i + 1];
+
+        if (arg[0] != '-')
+        {
+            if (*start == NULL)
+                *start = arg;
+            else if (bare == NULL)
+                bare = arg;
+            else
+                goto usage;
+            continue;
+        }
+        if (strcmp(arg, "--index") == 0 || strcmp(arg, "--locate") == 0)
+        {
+            *mode = arg[2] == 'i' ? FIND_INDEX : FIND_LOCATE;
+            continue;
+        }
+        if (strcmp(arg, "-quit") == 0)
+        {
+            e->limit = 1;
+            continue;
+        }
+        if (strncmp(arg, "-j", 2) == 0 && arg[2] != '\0')
+        {
+            *jobs = atoi(arg + 2);
+            continue;
+        }
+        if (val == NULL)
+            goto usage;
+        i++;
+        if (strcmp(arg, "-j") == 0)
+            *jobs = atoi(val);
+        else if (strcmp(arg, "-name") == 0 || strcmp(arg, "-iname") == 0)
+        {
+            glob_compile(&e->name, val, arg[1] == 'i');
+            e->has_name = 1;
+        }
+        else if (strcmp(arg, "-type") == 0)
+        {
+            for (j = 0; val[j] != '\0'; j++)
+            {
+                const char *types = "fdlpscb", *t = strchr(types, val[j]);
+                static const unsigned char dt[] = {DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK};
+                if (val[j] == ',')
+                    continue;
+                if (t == NULL)
+                    goto usage;
+                e->types |= 1u << dt[t - types];
+            }
+        }
+        else if (strcmp(arg, "-size") == 0)
+        {
+            if (parse_number(val, &e->size_cmp, &e->size, &e->unit, "ckMG") == -1)
+                goto usage;
+        }
+        else if (strcmp(arg, "-mtime") == 0)
+        {
+            if (parse_number(val, &e->mtime_cmp, &e->mtime, NULL, NULL) == -1)
+                goto usage;
+        }
+        else if (strcmp(arg, "-limit") == 0)
+        {
+            if ((e->limit = atol(val)) <= 0)
+                goto usage;
+        }
+        else if (strcmp(arg, "-maxdepth") == 0)
+        {
+            if (!isdigit((unsigned char)*val))
+                goto usage;
+            e->maxdepth = atoi(val);
+        }
+        else if (strcmp(arg, "-prune") == 0 && e->nprune < 8)
+            glob_compile(&e->prune[e->nprune++], val, 0);
+        else
+            goto usage;
+    }
+
+    if (*mode == FIND_LOCATE && (e->size_cmp != 2 || e->mtime_cmp != 2))
+    {
+        fprintf(stderr, "myfind: -size and -mtime need the tree, not the index\n");
+        return -1;
+    }
+    if (*mode == FIND_INDEX && (bare != NULL || e->has_name || e->types || e->size_cmp != 2 ||
+                                e->mtime_cmp != 2 || e->maxdepth >= 0 || e->nprune || e->limit))
+        goto usage;
+
+    // myfind name: the old form, a name to look for under the current directory
+    if (*mode != FIND_INDEX && bare == NULL && *start != NULL && !e->has_name && (stat(*start, &sb) == -1 || !S_ISDIR(sb.st_mode)))
+    {
+        bare = *start;
+        *start = NULL;
+    }
+    if (bare != NULL)
+    {
+        if (e->has_name)
+            goto usage;
+        glob_compile(&e->name, bare, 0);
+        e->has_name = 1;
+    }
+    if (*start == NULL)
+        *start = ".";
+    return 0;
+
+usage:
+    fprintf(stderr, "usage: myfind [-j workers | --locate] [path] [-name GLOB] [-iname GLOB] [-type fdlpscb] "
+                    "[-size [+-]N[ckMG]] [-mtime [+-]N] [-maxdepth N] [-prune GLOB] [-limit N | -quit]\n"
+                    "       myfind --index [path]\n");
+    return -1;
+}
+
+/*
+ * @brief --locate: the scan is over, -limit reached or CTRL + C
+ */
+static int locate_done(FINDLOCATE *l)
+{
+    return (l->e->limit > 0 && l->found >= l->e->limit) || atomic_load(&interrupted);
+}
+
+/*
+ * @brief --locate: a directory of the index, are its entries to be looked at
+ */
+static int locate_dir(void *ctx, const char *path, int depth)
+{
+    FINDLOCATE *l = ctx;
+    char name[256];
+    const char *p, *slash;
+
+    if (depth == 0) // the start path itself
+    {
+        p = strrchr(l->start, '/') != NULL && strrchr(l->start, '/')[1] != '\0' ? strrchr(l->start, '/') + 1 : l->start;
+        if (find_cheap(l->e, p, DT_DIR))
+        {
+            fprintf(l->out, "%s\n", l->start);
+            l->found++;
+        }
+    }
+    if (locate_done(l))
+        return -1;
+    if (l->e->maxdepth >= 0 && depth + 1 > l->e->maxdepth)
+        return 0;
+    if (l->e->nprune == 0)
+        return 1;
+    // under a pruned directory: one of the components matches
+    for (p = path; *p; p = *slash ? slash + 1 : slash)
+    {
+        slash = strchrnul(p, '/');
+        if ((size_t)(slash - p) < sizeof(name))
+        {
+            memcpy(name, p, slash - p);
+            name[slash - p] = '\0';
+            if (find_pruned(l->e, name))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static int locate_entry(void *ctx, const char *path, const char *name, unsigned char type, int depth)
+{
+    FINDLOCATE *l = ctx;
+
+    if (type == DT_DIR && find_pruned(l->e, name))
+        return 0;
+    if (!find_cheap(l->e, name, type))
+        return 0;
+    fputs(l->start, l->out);
+    if (*path)
+    {
+        fputc('/', l->out);
+        fputs(path, l->out);
+    }
+    fputc('/', l->out);
+    fputs(name, l->out);
+    fputc('\n', l->out);
+    l->found++;
+    return locate_done(l) ? -1 : 0;
+}
+
+/*
+ * @brief myfind [-j workers] [path] [predicates] - print the paths under path that match
+ *
+ * with --index the tree of path is written to its database, with --locate
+ * the predicates are answered from that database
+ */
+int exec_myfind(CMD *root, FILE *out)
+{
+    const char *start = NULL, *base;
+    struct stat sb;
+    FINDWALK w;
+    POOL *p;
+    int jobs = pool_default_size(), mode = FIND_WALK;
+
+    if (find_parse(root, &w.e, &start, &jobs, &mode) == -1)
+        return 2;
+    w.out = out;
+    atomic_init(&w.cancel, 0);
+    atomic_init(&w.failed, 0);
+    atomic_init(&w.found, 0);
+    if (mode == FIND_INDEX)
+        return findindex_build(start, out) == -1;
+    if (mode == FIND_LOCATE)
+    {
+        FINDLOCATE l = {&w.e, start, out, 0};
+        if (findindex_scan(start, locate_dir, locate_entry, &l) == -1)
+            return 1;
+        return atomic_load(&interrupted) ? 130 : 0;
+    }
+
+    // the start path itself, as find does (depth 0)
+    if (lstat(start, &sb) == -1)
+    {
+        fprintf(stderr, "myfind: %s: %s\n", start, strerror(errno));
+        return 1;
+    }
+    base = strrchr(start, '/') != NULL && strrchr(start, '/')[1] != '\0' ? strrchr(start, '/') + 1 : start;
+    if (find_cheap(&w.e, base, IFTODT(sb.st_mode)) && find_stat(&w.e, AT_FDCWD, start) && find_take(&w))
+        fprintf(out, "%s\n", start);
+    if (!S_ISDIR(sb.st_mode) || w.e.maxdepth == 0 || atomic_load(&w.cancel))
+        return 0;
+
+    p = pool_create(jobs, find_task, &w);
+    pool_submit(p, -1, find_dir_new(start, strlen(start), NULL, 0));
+    pool_wait(p);
+    return atomic_load(&interrupted) ? 130 : 0;
+}
@@ -0,0 +1,657 @@
+/*
+ * @file myls.c
+ * @brief myls builtin: listing of one directory
+ *
+ * The directory is read once with dir_next() (dirread.c) and every entry is
+ * looked at relative to its fd (statx() on fd + name, no path is built).
+ * statx() is only called when d_type is not enough: the type of a directory
+ * or a link is known from the entry, only regular files need the mode to be told executable, and
+ * DT_UNKNOWN (some file systems) needs the type. With -l the owner and the
+ * group are asked too, and their names come from a small cache instead of
+ * one getpwuid()/getgrgid() per line.
+ *
+ * The lines are rendered in an OUTBUF and handed to the FILE in big blocks.
+ * Colors and columns (as wide as the terminal) are only used when the
+ * output is a terminal, otherwise there is one name per line.
+ *
+ * myls -R runs on a pool of workers (pool.c), one task per directory. Every
+ * directory becomes a node of a tree: the worker that takes it renders its
+ * listing in memory and adds its subdirectories, sorted, as children. The
+ * calling thread walks the tree in pre-order and writes each listing as soon
+ * as it is done, so the output is the same whatever the number of workers;
+ * when it reaches a node nobody took yet it reads it itself instead of
+ * waiting. The workers do not start a new directory while more than
+ * LS_BUFFERED_MAX bytes wait to be written, so memory stays bounded however
+ * big the tree is.
+ */
+
+#include "header.h"
+
+#define LS_LONG 1
+#define LS_ALL 2
+#define LS_RECURSIVE 4
+#define LS_TTY 8 // colors and columns
+
+#define LS_BUFFERED_MAX (4 << 20) // rendered by the workers, not written yet
+
+#define NODE_PENDING 0
+#define NODE_RUNNING 1
+#define NODE_DONE 2
+
+#define NAME_CACHE 64 // uid and gid names, power of 2
+#define OUTBUF_SIZE 65536
+
+typedef struct ls_entry {
+    size_t name;     // offset in the names buffer
+    unsigned char type; // DT_*
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+} LSENTRY;
+
+typedef struct id_name {
+    unsigned int id;
+    char *name;      // NULL = free slot
+} IDNAME;
+
+/* output rendered in memory, written in blocks (or kept, when out is NULL) */
+typedef struct outbuf {
+    char *data;
+    size_t len, cap;
+    FILE *out;
+} OUTBUF;
+
+/* directory of a myls -R */
+typedef struct ls_node {
+    char *path;
+    atomic_int state;          // NODE_*
+    atomic_int refs;           // the tree, plus the deque while it is queued
+    char *out;                 // rendered listing
+    size_t outlen;
+    char *names;               // with -limit the writer renders, from these
+    LSENTRY *entries;
+    int n;
+    size_t held;               // bytes counted in buffered
+    struct ls_node **children; // subdirectories, sorted
+    int nchildren;
+} LSNODE;
+
+/* state shared by the workers and the writer of a myls -R */
+typedef struct ls_walk {
+    int flags;
+    POOL *pool;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;       // a node is done or buffered went down
+    size_t buffered;           // bytes rendered and not written yet
+    atomic_int cancel;         // the output failed or -limit reached, nothing more is read
+    atomic_int errors;         // directories that could not be read
+    long limit;                // entries left to list (writer only), -1 = no limit
+} LSWALK;
+
+static IDNAME users[NAME_CACHE], groups[NAME_CACHE];
+static pthread_mutex_t names_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * @brief name of a uid or gid, remembered for the next lines
+ * @param IDNAME* cache - users or groups
+ * @param unsigned int id - uid or gid
+ * @param char* buf - room for the number when the id has no name
+ * @return the name (valid for the session) or buf
+ *
+ * a full slot chain is simply not cached, the lookup is done again
+ */
+static const char *id_name(IDNAME *cache, unsigned int id, char *buf)
+{
+    unsigned int h = id & (NAME_CACHE - 1), k;
+    char tmp[1024];
+    const char *name = NULL;
+
+    pthread_mutex_lock(&names_mutex);
+    for (k = 0; k < NAME_CACHE && cache[h].name != NULL; k++, h = (h + 1) & (NAME_CACHE - 1))
+    {
+        if (cache[h].id == id)
+        {
+            pthread_mutex_unlock(&names_mutex);
+            return cache[h].name;
+        }
+    }
+    pthread_mutex_unlock(&names_mutex);
+
+    if (cache == users)
+    {
+        struct passwd pw, *r = NULL;
+        if (getpwuid_r(id, &pw, tmp, sizeof(tmp), &r) == 0 && r != NULL)
+            name = pw.pw_name;
+    }
+    else
+    {
+        struct group gr, *r = NULL;
+        if (getgrgid_r(id, &gr, tmp, sizeof(tmp), &r) == 0 && r != NULL)
+            name = gr.gr_name;
+    }
+    if (name == NULL)
+    {
+        sprintf(buf, "%u", id);
+        name = buf;
+    }
+
+    pthread_mutex_lock(&names_mutex);
+    if (k < NAME_CACHE && cache[h].name == NULL)
+    {
+        cache[h].id = id;
+        cache[h].name = strdup(name);
+        name = cache[h].name;
+    }
+    pthread_mutex_unlock(&names_mutex);
+    return name;
+}
+
+static void ob_flush(OUTBUF *ob)
+{
+    if (ob->out == NULL)
+        return;
+    if (ob->len > 0)
+        fwrite(ob->data, 1, ob->len, ob->out);
+    ob->len = 0;
+}
+
+static void ob_put(OUTBUF *ob, const char *s, size_t n)
+{
+    if (ob->out == NULL && ob->len + n > ob->cap)
+        ob->data = realloc(ob->data, ob->cap = (ob->len + n) * 2);
+    else if (ob->len + n > OUTBUF_SIZE)
+    {
+        ob_flush(ob);
+        if (n > OUTBUF_SIZE)
+        {
+            fwrite(s, 1, n, ob->out);
+            return;
+        }
+    }
+    memcpy(ob->data + ob->len, s, n);
+    ob->len += n;
+}
+
+static void ob_puts(OUTBUF *ob, const char *s)
+{
+    ob_put(ob, s, strlen(s));
+}
+
+/*
+ * @brief s padded with blanks to width
+ */
+static void ob_pad(OUTBUF *ob, const char *s, size_t width)
+{
+    static const char blanks[] = "                                ";
+    size_t len = strlen(s);
+
+    ob_put(ob, s, len);
+    while (len < width)
+    {
+        size_t k = width - len < sizeof(blanks) - 1 ? width - len : sizeof(blanks) - 1;
+        ob_put(ob, blanks, k);
+        len += k;
+    }
+}
+
+/*
+ * @brief -rwxr-xr-x
+ */
+static void mode_string(unsigned char type, mode_t mode, char *s)
+{
+    static const char types[] = "?pc?d?b?-?l?s???"; // by DT_*
+    static const char perms[8][4] = {"---", "--x", "-w-", "-wx", "r--", "r-x", "rw-", "rwx"};
+
+    s[0] = types[type & 15];
+    memcpy(s + 1, perms[(mode >> 6) & 7], 3);
+    memcpy(s + 4, perms[(mode >> 3) & 7], 3);
+    memcpy(s + 7, perms[mode & 7], 3);
+    s[10] = '\0';
+}
+
+/*
+ * @brief width of the terminal, the output of the shell when myls writes to one
+ */
+static int terminal_width()
+{
+    struct winsize ws;
+    char *columns;
+
+    if (ioctl(1, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        return ws.ws_col;
+    if ((columns = getenv("COLUMNS")) != NULL && atoi(columns) > 0)
+        return atoi(columns);
+    return 80;
+}
+
+static int compare_entries(const void *a, const void *b, void *names)
+{
+    return strcmp((char *)names + ((const LSENTRY *)a)->name, (char *)names + ((const LSENTRY *)b)->name);
+}
+
+/*
+ * @brief color of an entry, "" for none
+ */
+static const char *ls_color(const char *name, LSENTRY *e)
+{
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0)
+        return VERMELHO;
+    if (e->type == DT_DIR)
+        return AZUL;
+    if (e->type == DT_LNK)
+        return CYAN;
+    if (e->type == DT_REG && (e->mode & (S_IXUSR | S_IXGRP | S_IXOTH)))
+        return VERDE;
+    return "";
+}
+
+/*
+ * @brief render the sorted entries
+ * @param const char* names - names buffer
+ * @param LSENTRY* entries - entries
+ * @param int n - number of entries
+ * @param int flags - LS_*
+ * @param OUTBUF* ob - output
+ *
+ * short listing on a terminal: column-major, every column as wide as the longest name
+ */
+static void ls_print(const char *names, LSENTRY *entries, int n, int flags, OUTBUF *ob)
+{
+    int tty = flags & LS_TTY, i, r, c;
+    int cols = 1, rows = n;
+    size_t width = 0;
+
+    if (!(flags & LS_LONG) && tty && n > 0)
+    {
+        for (i = 0; i < n; i++)
+            if (strlen(names + entries[i].name) > width)
+                width = strlen(names + entries[i].name);
+        width += 2;
+        cols = terminal_width() / width;
+        if (cols < 1)
+            cols = 1;
+        rows = (n + cols - 1) / cols;
+    }
+
+    for (r = 0; r < rows && !(ob->out && ferror(ob->out)); r++)
+    {
+        for (c = 0; c < cols && (i = c * rows + r) < n; c++)
+        {
+            LSENTRY *e = &entries[i];
+            const char *name = names + e->name;
+            const char *color = tty ? ls_color(name, e) : "";
+
+            if (flags & LS_LONG)
+            {
+                char mode[11], ubuf[16], gbuf[16];
+                mode_string(e->type, e->mode, mode);
+                ob_put(ob, mode, 10);
+                ob_put(ob, " ", 1);
+                ob_pad(ob, id_name(users, e->uid, ubuf), 9);
+                ob_pad(ob, id_name(groups, e->gid, gbuf), 9);
+            }
+            ob_puts(ob, color);
+            if (c + 1 < cols && (c + 1) * rows + r < n)
+                ob_pad(ob, name, width); // not the last of the row
+            else
+                ob_puts(ob, name);
+            if (*color)
+                ob_puts(ob, BRANCO);
+        }
+        ob_put(ob, "\n", 1);
+    }
+}
+
+/*
+ * @brief read and sort a directory
+ * @param const char* path - directory
+ * @param int flags - LS_*
+ * @param char** names - set to the names buffer (malloc'd)
+ * @param LSENTRY** entries - set to the entries (malloc'd)
+ * @return number of entries or -1 if the directory could not be read (error printed)
+ */
+static int ls_read(const char *path, int flags, char **names, LSENTRY **entries)
+{
+    int n = 0, cap = 256;
+    size_t used = 0, size = 16384;
+    unsigned int mask = STATX_TYPE | STATX_MODE;
+    struct dirent64 *entry;
+    struct statx stx;
+    DIRREAD dir;
+
+    if (flags & LS_LONG)
+        mask |= STATX_UID | STATX_GID;
+    if (dir_open(&dir, AT_FDCWD, path) == -1)
+    {
+        fprintf(stderr, "myls: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    *names = malloc(size);
+    *entries = malloc(cap * sizeof(LSENTRY));
+
+    while ((entry = dir_next(&dir)) != NULL)
+    {
+        size_t len = strlen(entry->d_name) + 1;
+        LSENTRY *e;
+
+        if (entry->d_name[0] == '.' && !(flags & LS_ALL))
+            continue;
+        if (n == cap)
+            *entries = realloc(*entries, (cap *= 2) * sizeof(LSENTRY));
+        e = &(*entries)[n];
+        e->type = entry->d_type;
+        e->mode = 0;
+        // the short listing needs nothing but the name, or the type for the
+        // colors and -R, plus the mode of the regular files to tell an executable
+        if ((flags & LS_LONG) || (e->type == DT_UNKNOWN && (flags & (LS_TTY | LS_RECURSIVE))) ||
+            (e->type == DT_REG && (flags & LS_TTY)))
+        {
+            if (statx(dir.fd, entry->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, mask, &stx) == -1)
+                continue; // removed meanwhile
+            e->type = IFTODT(stx.stx_mode);
+            e->mode = stx.stx_mode;
+            e->uid = stx.stx_uid;
+            e->gid = stx.stx_gid;
+        }
+        if (used + len > size)
+            *names = realloc(*names, size = (size + len) * 2);
+        memcpy(*names + used, entry->d_name, len);
+        e->name = used;
+        used += len;
+        n++;
+    }
+    dir_close(&dir);
+
+    qsort_r(*entries, n, sizeof(LSENTRY), compare_entries, *names);
+    return n;
+}
+
+/*
+ * @brief list one directory
+ * @param const char* path - directory
+ * @param int flags - LS_*
+ * @param long limit - entries to list at most, -1 for all
+ * @param FILE* out - output
+ * @return 0 or 1 if the directory could not be read
+ */
+static int ls_dir(const char *path, int flags, long limit, FILE *out)
+{
+    OUTBUF ob = {NULL, 0, OUTBUF_SIZE, out};
+    LSENTRY *entries;
+    char *names;
+    int n;
+
+    if ((n = ls_read(path, flags, &names, &entries)) == -1)
+        return 1;
+    ob.data = malloc(OUTBUF_SIZE);
+    ls_print(names, entries, limit >= 0 && n > limit ? limit : n, flags, &ob);
+    ob_flush(&ob);
+    free(ob.data);
+    free(names);
+    free(entries);
+    return 0;
+}
+
+/*
+ * @brief the output failed, -limit is reached or CTRL + C
+ */
+static int ls_cancelled(LSWALK *w)
+{
+    return atomic_load(&w->cancel) || atomic_load(&interrupted);
+}
+
+static LSNODE *ls_node_new(const char *parent, const char *name, int refs)
+{
+    LSNODE *node = calloc(1, sizeof(LSNODE));
+    size_t len = strlen(parent);
+
+    if (name == NULL)
+        node->path = strdup(parent);
+    else
+    {
+        node->path = malloc(len + strlen(name) + 2);
+        sprintf(node->path, len > 0 && parent[len - 1] == '/' ? "%s%s" : "%s/%s", parent, name);
+    }
+    atomic_init(&node->state, NODE_PENDING);
+    atomic_init(&node->refs, refs);
+    return node;
+}
+
+static void ls_node_unref(LSNODE *node)
+{
+    if (atomic_fetch_sub(&node->refs, 1) == 1)
+    {
+        free(node->path);
+        free(node->out);
+        free(node->names);
+        free(node->entries);
+        free(node->children);
+        free(node);
+    }
+}
+
+/*
+ * @brief read and render a directory, its subdirectories become tasks
+ * @param LSWALK* w - walk
+ * @param int worker - calling worker or -1 (the writer)
+ * @param LSNODE* node - node in NODE_RUNNING
+ */
+static void ls_node_run(LSWALK *w, int worker, LSNODE *node)
+{
+    OUTBUF ob = {NULL, 0, 0, NULL};
+    LSENTRY *entries;
+    char *names;
+    size_t held = 0;
+    int n = -1, i, k = 0;
+
+    if (!ls_cancelled(w) && (n = ls_read(node->path, w->flags, &names, &entries)) == -1)
+        atomic_fetch_add(&w->errors, 1);
+    if (n >= 0)
+    {
+        if (w->limit < 0)
+        {
+            ob_puts(&ob, node->path);
+            ob_put(&ob, ":\n", 2);
+            ls_print(names, entries, n, w->flags, &ob);
+            held = ob.len;
+        }
+        for (i = 0; i < n; i++)
+        {
+            if (entries[i].type == DT_DIR)
+                k++;
+            held += w->limit < 0 ? 0 : sizeof(LSENTRY) + strlen(names + entries[i].name) + 1;
+        }
+        node->children = malloc(k * sizeof(LSNODE *));
+        for (i = 0; i < n; i++)
+        {
+            const char *name = names + entries[i].name;
+            if (entries[i].type == DT_DIR && strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+                node->children[node->nchildren++] = ls_node_new(node->path, name, 2);
+        }
+        if (w->limit < 0)
+        {
+            free(names);
+            free(entries);
+        }
+        else // how many of them are listed is known when the writer gets there
+        {
+            node->names = names;
+            node->entries = entries;
+            node->n = n;
+        }
+    }
+    // the last one submitted is the first one taken back by this worker
+    for (i = node->nchildren - 1; i >= 0; i--)
+        pool_submit(w->pool, worker, node->children[i]);
+
+    pthread_mutex_lock(&w->lock);
+    node->out = ob.data;
+    node->outlen = ob.len;
+    node->held = held;
+    w->buffered += held;
+    atomic_store(&node->state, NODE_DONE);
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ * @brief task of a worker: a directory, unless the writer took it already
+ */
+static void ls_node_task(POOL *p, int worker, void *task)
+{
+    LSWALK *w = pool_context(p);
+    LSNODE *node = task;
+    int expected = NODE_PENDING;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->buffered > LS_BUFFERED_MAX && atomic_load(&node->state) == NODE_PENDING && !ls_cancelled(w))
+        pthread_cond_wait(&w->cond, &w->lock);
+    pthread_mutex_unlock(&w->lock);
+    if (atomic_compare_exchange_strong(&node->state, &expected, NODE_RUNNING))
+        ls_node_run(w, worker, node);
+    ls_node_unref(node); // reference of the deque
+}
+
+/*
+ * @brief write a node and its subtree, in pre-order
+ */
+static void ls_emit(LSWALK *w, LSNODE *node, FILE *out, int first)
+{
+    int expected = NODE_PENDING, i, last = 0;
+
+    if (atomic_compare_exchange_strong(&node->state, &expected, NODE_RUNNING))
+        ls_node_run(w, -1, node); // nobody took it yet
+    else
+    {
+        pthread_mutex_lock(&w->lock);
+        while (atomic_load(&node->state) != NODE_DONE)
+            pthread_cond_wait(&w->cond, &w->lock);
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    if (w->limit >= 0 && node->entries != NULL && !ls_cancelled(w))
+    {
+        OUTBUF ob = {NULL, 0, 0, NULL};
+        int n = node->n > w->limit ? w->limit : node->n;
+
+        ob_puts(&ob, node->path);
+        ob_put(&ob, ":\n", 2);
+        ls_print(node->names, node->entries, n, w->flags, &ob);
+        node->out = ob.data;
+        node->outlen = ob.len;
+        last = (w->limit -= n) == 0;
+    }
+    if ((last || !ls_cancelled(w)) && node->outlen > 0)
+    {
+        if (!first)
+            fputc('\n', out);
+        fwrite(node->out, 1, node->outlen, out);
+        if (ferror(out))
+            atomic_store(&w->cancel, 1);
+    }
+    if (last) // -limit reached, the workers stop reading
+        atomic_store(&w->cancel, 1);
+    pthread_mutex_lock(&w->lock);
+    w->buffered -= node->held;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    free(node->out);
+    node->out = NULL;
+    free(node->names);
+    free(node->entries);
+    node->names = NULL;
+    node->entries = NULL;
+
+    for (i = 0; i < node->nchildren; i++)
+        ls_emit(w, node->children[i], out, 0);
+    ls_node_unref(node); // reference of the tree
+}
+
+/*
+ * @brief myls -R
+ * @param const char* path - directory to start from
+ * @param int flags - LS_*
+ * @param int jobs - number of workers
+ * @param long limit - entries to list at most, -1 for all
+ * @param FILE* out - output
+ * @return 0 or 1 if a directory could not be read
+ */
+static int ls_recursive(const char *path, int flags, int jobs, long limit, FILE *out)
+{
+    LSWALK w;
+
+    w.flags = flags;
+    w.limit = limit;
+    w.buffered = 0;
+    atomic_init(&w.cancel, 0);
+    atomic_init(&w.errors, 0);
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.cond, NULL);
+    w.pool = pool_create(jobs, ls_node_task, &w);
+
+    ls_emit(&w, ls_node_new(path, NULL, 1), out, 1);
+
+    pool_wait(w.pool);
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.cond);
+    if (atomic_load(&interrupted))
+        return 130;
+    return atomic_load(&w.errors) > 0;
+}
+
+/*
+ * @brief myls [-l] [-a] [-R] [-j workers] [-limit N] [directory] - flags may be joined (-al, -lR)
+ *
+ * -limit N lists the first N entries (in the order of the listing) and stops the walk there
+ */
+int exec_myls(CMD *root, FILE *out)
+{
+    const char *dir = ".";
+    int flags = 0, jobs = pool_default_size(), i, j;
+    long limit = -1;
+
+    for (i = 1; root->argv[i] != NULL; i++)
+    {
+        char *arg = root->argv[i];
+        if (arg[0] != '-' || arg[1] == '\0')
+        {
+            dir = arg;
+            continue;
+        }
+        if (strcmp(arg, "-limit") == 0)
+        {
+            if (root->argv[i + 1] == NULL || (limit = atol(root->argv[++i])) < 0)
+                goto usage;
+            continue;
+        }
+        for (j = 1; arg[j] != '\0'; j++)
+        {
+            if (arg[j] == 'l')
+                flags |= LS_LONG;
+            else if (arg[j] == 'a')
+                flags |= LS_ALL;
+            else if (arg[j] == 'R')
+                flags |= LS_RECURSIVE;
+            else if (arg[j] == 'j' && (arg[j + 1] != '\0' || root->argv[i + 1] != NULL))
+            {
+                jobs = atoi(arg[j + 1] != '\0' ? arg + j + 1 : root->argv[++i]);
+                break;
+            }
+            else
+            {
+                fprintf(stderr, "myls: invalid option -- '%c'\n", arg[j]);
+                goto usage;
+            }
+        }
+    }
+
+    if (isatty(fileno(out)))
+        flags |= LS_TTY;
+    if (flags & LS_RECURSIVE)
+        return ls_recursive(dir, flags, jobs, limit, out);
+    return ls_dir(dir, flags, limit, out);
+
+usage:
+    fprintf(stderr, "usage: myls [-alR] [-j workers] [-limit N] [directory]\n");
+    return 2;
+}
@@ -3,6 +3,8 @@
  * @author Rafael Ferreira
  * @date Mar 2018
  * @brief Parse line to CMD
+ *
+ * every node and string of the list comes from line_arena (see arena.c)
  */
 
 #include "header.h"
@@ -31,48 +33,21 @@ void print_command_list(CMD *root)
             printf("Outfile = %s\n", temp->outfile);
         if (temp->errfile != NULL)
             printf("Errfile = %s\n", temp->errfile);
+        if (temp->background)
+            printf("Background\n");
+        if (temp->timed)
+            printf("Timed\n");
     }
 }
 
 /*
  * @brief Delete the command list
+ *
+ * the list lives in line_arena, resetting it frees every node and string at once
  */
 void free_command_list(CMD *root)
 {
-    CMD *temp1, *temp2;
-    int i;
-
-    temp1 = root;
-
-    while (temp1 != NULL)
-    {
-
-        free(temp1->name);
-
-        for (i = 0; temp1->argv[i] != NULL; i++)
-        {
-            free(temp1->argv[i]);
-            temp1->argv[i] = NULL;
-        }
-
-        if (temp1->infile != NULL)
-            free(temp1->infile);
-        if (temp1->outfile != NULL)
-            free(temp1->outfile);
-        if (temp1->errfile != NULL)
-            free(temp1->errfile);
-
-        // to avoid dangling pointers
-        temp1->errfile = NULL;
-        temp1->infile = NULL;
-        temp1->name = NULL;
-        temp1->outfile = NULL;
-
-        temp2 = temp1;
-        temp1 = temp2->next;
-        free(temp2);
-        temp2 = NULL;
-    }
+    arena_reset(&line_arena);
 }
 
 /*
@@ -82,21 +57,19 @@ void free_command_list(CMD *root)
 struct command *insert_command()
 {
     CMD *new;
-    new = (CMD *)malloc(sizeof(CMD));
-    if (new == NULL)
-    {
-        perror("malloc error!\n");
-        exit(1);
-    }
+    new = (CMD *)arena_alloc(&line_arena, sizeof(CMD));
 
     //It is necessary to initialize the node, since we have no guarantees than the
     //function parse_line() will do it (the line of text may be empty ...)
 
     new->name = NULL;
-    new->argv[0] = NULL;
+    memset(new->argv, 0, sizeof(new->argv)); // the arena memory is reused
     new->infile = NULL;
     new->outfile = NULL;
     new->errfile = NULL;
+    new->background = 0;
+    new->error = 0;
+    new->timed = 0;
     new->next = NULL;
 
     return new;
@@ -105,78 +78,82 @@ struct command *insert_command()
 /*
  * @brief parse line  to right spot in the structure CMD
  * @returno root - Structure CMD
+ *
+ * the tokens come from lex_line(); argv and the file names point into the
+ * line itself (unquoted in place), so the line must live while root is used.
+ * On a syntax error a message is printed, root has no command and error set.
  */
 CMD *parse_line(char *line)
 {
-    char *a;
-    int n, count = 0;
-    char *name, *param, *infile, *outfile, *errfile;
+    int n, i, count = 0;
+    char **file;
     CMD *command, *root;
+    TOKEN *tokens = arena_alloc(&line_arena, (strlen(line) + 1) * sizeof(TOKEN));
 
     root = insert_command(); // Let's install the first one on the list
     command = root;
-    a = strtok(line, " \t\r\n");
-    for (n = 0; a; n++)
+    if ((n = lex_line(line, tokens)) == -1)
     {
-        if (command->argv[0] != NULL && (n != 0 && strcmp(command->argv[0], "echo") == 0) && a[0] != '|' && a[0] != '<' && a[0] != '>' && (a[0] != '2' && a[1] != '>'))
-        {
-            if (command->argv[1] == NULL)
-            {
-                command->argv[1] = strdup(a);
-            }
-            else
-            {
-               char *echo_string = malloc(strlen(command->argv[1]) + strlen(a) + 2);
-               strcpy(echo_string, command->argv[1]);
-               strcat(echo_string, " ");
-               strcat(echo_string, a);
-               command->argv[1] = strdup(echo_string);
-            }
-            count = 2;
-        }
-        if (a[0] == '|')
+        fprintf(stderr, "msh: unterminated quote\n");
+        root->error = 1;
+        return root;
+    }
+    for (i = 0; i < n; i++)
+    {
+        TOKEN *t = &tokens[i];
+        // the '\0' of a word may be written over the first char of the next
+        // token, which is an operator already classified or a blank
+        if (t->type == TOK_PIPE)
         {
+            if (count == 0)
+                break;
+            command->argv[count] = NULL; // to mark the end of the vector
             command->next = insert_command(); // We have a new command so let's insert a new node in the list
             command = command->next;
             count = 0;
         }
-        else if (a[0] == '<')
-        {
-            infile = a[1] ? a + 1 : strtok(NULL, " \t\r\n");
-            command->infile = strdup(infile);
-        }
-        else if (a[0] == '>')
+        else if (t->type == TOK_AMP)
         {
-            outfile = a[1] ? a + 1 : strtok(NULL, " \t\r\n");
-            command->outfile = strdup(outfile);
+            if (i + 1 != n) // only at the end of the line
+                count = 0;
+            root->background = 1;
+            break;
         }
-        else if (a[0] == '2' && a[1] == '>')
+        else if (t->type != TOK_WORD)
         {
-            errfile = a[2] ? a + 2 : strtok(NULL, " \t\r\n");
-            command->errfile = strdup(errfile);
-        }
-        else
-        {
-            if (!count)
-            { // count==0 implies that we have the command name and the value for argv[0]
-                name = a;
-                command->name = strdup(name);
-                command->argv[count] = strdup(name);
-                count++;
+            file = t->type == TOK_IN ? &command->infile : t->type == TOK_OUT ? &command->outfile : &command->errfile;
+            if (i + 1 == n || tokens[i + 1].type != TOK_WORD)
+            {
+                count = 0;
+                break;
             }
+            t = &tokens[++i];
+            *file = lex_unquote(line + t->off, t->len);
+        }
+        else if (command == root && count == 0 && !root->timed && !t->quoted &&
+                 t->len == 4 && strncmp(line + t->off, "time", 4) == 0)
+            root->timed = 1; // time prefix, see timing.c
+        else if (count < MAXARGS - 1)
+        { // To ensure that the arguments do not exceed the size of the vector...
+            if (t->quoted)
+                command->argv[count] = lex_unquote(line + t->off, t->len);
             else
-            { //count != 0 implies that we have all the arguments of the program
-                param = a;
-                if (count < MAXARGS - 1)
-                { // To ensure that the arguments do not exceed the size of the vector...
-                    command->argv[count] = strdup(param);
-                    count++;
-                }
+            {
+                command->argv[count] = line + t->off;
+                line[t->off + t->len] = '\0';
             }
+            if (count == 0) // count==0 implies that we have the command name and the value for argv[0]
+                command->name = command->argv[0];
+            count++;
         }
-
-        a = strtok(NULL, " \t\r\n");
     }
     command->argv[count] = NULL; // to mark the end of the vector
+    if (count == 0 && n > 0)
+    {
+        fprintf(stderr, "msh: syntax error\n");
+        root->error = 1;
+        root->argv[0] = NULL;
+        root->next = NULL;
+    }
     return root;
 }
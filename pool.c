@@ -0,0 +1,242 @@
+/*
+ * @file pool.c
+ * @brief Fixed pool of worker threads with work-stealing deques
+ *
+ * Every worker owns a deque: the tasks it submits go to the bottom and it
+ * takes them back from the bottom (depth first, the data is still warm),
+ * an idle worker steals from the top of the others (the oldest, biggest
+ * subtrees). The deques are small arrays under their own mutex, contention
+ * only happens on steals.
+ *
+ * outstanding counts the tasks submitted and not finished yet: a task
+ * submits its subtasks before it ends, so when it drops to 0 there is no
+ * more work anywhere and the workers leave. queued counts the tasks sitting
+ * in the deques, it is what an idle worker checks (under idle_lock) before
+ * going to sleep, so a submit can not be missed.
+ */
+
+#include "header.h"
+
+typedef struct deque {
+    pthread_mutex_t lock;
+    void **items;
+    int top, bottom, cap; // items[top..bottom-1], top moves on steals
+} DEQUE;
+
+struct pool {
+    int n;
+    DEQUE *deques;
+    pthread_t *tids;
+    void (*fn)(POOL *p, int worker, void *task);
+    void *ctx;
+    atomic_long outstanding;
+    atomic_long queued;
+    atomic_uint next; // round robin for the tasks submitted from outside
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    int sleepers;
+    STAGETIME *time; // timed stage that started the pool (see timing.c) or NULL
+    struct rusage ru; // usage of the workers gone, under idle_lock
+};
+
+typedef struct worker_arg {
+    POOL *p;
+    int id;
+} WORKERARG;
+
+static void deque_push(DEQUE *d, void *task)
+{
+    pthread_mutex_lock(&d->lock);
+    if (d->bottom == d->cap)
+    {
+        if (d->top > 0) // room left by the steals
+        {
+            memmove(d->items, d->items + d->top, (d->bottom - d->top) * sizeof(void *));
+            d->bottom -= d->top;
+            d->top = 0;
+        }
+        if (d->bottom == d->cap)
+            d->items = realloc(d->items, (d->cap *= 2) * sizeof(void *));
+    }
+    d->items[d->bottom++] = task;
+    pthread_mutex_unlock(&d->lock);
+}
+
+/*
+ * @brief take a task from the bottom (owner) or the top (thief)
+ */
+static void *deque_take(DEQUE *d, int steal)
+{
+    void *task = NULL;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom)
+        task = steal ? d->items[d->top++] : d->items[--d->bottom];
+    if (d->top == d->bottom)
+        d->top = d->bottom = 0;
+    pthread_mutex_unlock(&d->lock);
+    return task;
+}
+
+/*
+ * @brief own deque first, then the others from the next one on
+ */
+static void *pool_take(POOL *p, int id)
+{
+    void *task;
+    int k;
+
+    if ((task = deque_take(&p->deques[id], 0)) != NULL)
+        return task;
+    for (k = 1; k < p->n; k++)
+    {
+        if ((task = deque_take(&p->deques[(id + k) % p->n], 1)) != NULL)
+            return task;
+    }
+    return NULL;
+}
+
+static void *pool_worker(void *arg)
+{
+    WORKERARG *w = arg;
+    POOL *p = w->p;
+    void *task;
+
+    for (;;)
+    {
+        if ((task = pool_take(p, w->id)) != NULL)
+        {
+            atomic_fetch_sub(&p->queued, 1);
+            p->fn(p, w->id, task);
+            if (atomic_fetch_sub(&p->outstanding, 1) == 1)
+            {
+                pthread_mutex_lock(&p->idle_lock);
+                pthread_cond_broadcast(&p->idle_cond); // everything is done
+                pthread_mutex_unlock(&p->idle_lock);
+            }
+            continue;
+        }
+        pthread_mutex_lock(&p->idle_lock);
+        if (atomic_load(&p->outstanding) == 0)
+        {
+            pthread_mutex_unlock(&p->idle_lock);
+            break;
+        }
+        if (atomic_load(&p->queued) == 0)
+        {
+            p->sleepers++;
+            pthread_cond_wait(&p->idle_cond, &p->idle_lock);
+            p->sleepers--;
+        }
+        pthread_mutex_unlock(&p->idle_lock);
+    }
+    if (p->time != NULL)
+    {
+        struct rusage ru;
+        getrusage(RUSAGE_THREAD, &ru);
+        pthread_mutex_lock(&p->idle_lock);
+        timing_add(&p->ru, &ru);
+        pthread_mutex_unlock(&p->idle_lock);
+    }
+    free(w);
+    return NULL;
+}
+
+/*
+ * @brief number of workers when none is asked for: the online cores
+ */
+int pool_default_size()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n < 1 ? 1 : n > POOL_MAX ? POOL_MAX : (int)n;
+}
+
+/*
+ * @brief start the workers
+ * @param int n - number of workers (clamped to 1..POOL_MAX)
+ * @param fn - runs a task, may call pool_submit() with its worker number
+ * @param void* ctx - given back by pool_context()
+ * @return the pool, its workers run until pool_wait() and no task is left
+ */
+POOL *pool_create(int n, void (*fn)(POOL *p, int worker, void *task), void *ctx)
+{
+    POOL *p = calloc(1, sizeof(POOL));
+    int i;
+
+    p->n = n < 1 ? 1 : n > POOL_MAX ? POOL_MAX : n;
+    p->fn = fn;
+    p->ctx = ctx;
+    p->time = timing_stage;
+    p->deques = calloc(p->n, sizeof(DEQUE));
+    p->tids = malloc(p->n * sizeof(pthread_t));
+    atomic_init(&p->outstanding, 1); // held until pool_wait(), so no worker leaves too soon
+    atomic_init(&p->queued, 0);
+    atomic_init(&p->next, 0);
+    pthread_mutex_init(&p->idle_lock, NULL);
+    pthread_cond_init(&p->idle_cond, NULL);
+    for (i = 0; i < p->n; i++)
+    {
+        WORKERARG *w = malloc(sizeof(WORKERARG));
+        pthread_mutex_init(&p->deques[i].lock, NULL);
+        p->deques[i].cap = 64;
+        p->deques[i].items = malloc(64 * sizeof(void *));
+        w->p = p;
+        w->id = i;
+        pthread_create(&p->tids[i], NULL, pool_worker, w);
+    }
+    return p;
+}
+
+void *pool_context(POOL *p)
+{
+    return p->ctx;
+}
+
+/*
+ * @brief add a task
+ * @param POOL* p - pool
+ * @param int worker - number of the calling worker, -1 from another thread
+ * @param void* task - given to fn
+ */
+void pool_submit(POOL *p, int worker, void *task)
+{
+    if (worker < 0)
+        worker = atomic_fetch_add(&p->next, 1) % p->n;
+    atomic_fetch_add(&p->outstanding, 1);
+    deque_push(&p->deques[worker], task);
+    atomic_fetch_add(&p->queued, 1);
+    pthread_mutex_lock(&p->idle_lock);
+    if (p->sleepers > 0)
+        pthread_cond_signal(&p->idle_cond);
+    pthread_mutex_unlock(&p->idle_lock);
+}
+
+/*
+ * @brief wait for every task to be done, stop the workers and free the pool
+ *
+ * the usage of the workers goes to the timed stage that started the pool
+ */
+void pool_wait(POOL *p)
+{
+    int i;
+
+    if (atomic_fetch_sub(&p->outstanding, 1) == 1)
+    {
+        pthread_mutex_lock(&p->idle_lock);
+        pthread_cond_broadcast(&p->idle_cond);
+        pthread_mutex_unlock(&p->idle_lock);
+    }
+    for (i = 0; i < p->n; i++)
+    {
+        pthread_join(p->tids[i], NULL);
+        pthread_mutex_destroy(&p->deques[i].lock);
+        free(p->deques[i].items);
+    }
+    if (p->time != NULL)
+        timing_add(&p->time->ru, &p->ru);
+    pthread_mutex_destroy(&p->idle_lock);
+    pthread_cond_destroy(&p->idle_cond);
+    free(p->deques);
+    free(p->tids);
+    free(p);
+}
@@ -0,0 +1,147 @@
+/*
+ * @file spawn.c
+ * @brief Launch one stage of a pipeline with posix_spawn
+ *
+ * fork() copies the page tables of the shell (completion dictionary, history...)
+ * for every command. posix_spawn (clone with CLONE_VM | CLONE_VFORK in glibc)
+ * does not, the pipes and the files of CMD are given as file actions that
+ * run in the child before the exec.
+ */
+
+#include "header.h"
+
+extern char **environ;
+
+/*
+ * @brief spawn a command
+ * @param CMD* aux - command with its redirections
+ * @param const char* prog - absolute path to execute (from hash_lookup) or NULL
+ * @param int in - pipe to use as stdin or -1
+ * @param int out - pipe to use as stdout or -1
+ * @param pid_t* pgid - process group to join (0 = new group, set to the pid) or NULL
+ * @return pid of the child or -1 (error already printed)
+ *
+ * the pipes are applied first, so infile/outfile/errfile take precedence;
+ * they are O_CLOEXEC, the child keeps only the copies on 0 and 1
+ */
+pid_t spawn_command(CMD *aux, const char *prog, int in, int out, pid_t *pgid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t def, mask;
+    pid_t pid;
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    int err;
+
+    if (prog == NULL)
+    {
+        fprintf(stderr, "%s: command not found\n", aux->argv[0]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    if (in != -1) // Read from the previous pipe (if it is not the first one)
+    {
+        posix_spawn_file_actions_adddup2(&actions, in, 0);
+    }
+    if (out != -1) // Write to the pipe (if not the last one)
+    {
+        posix_spawn_file_actions_adddup2(&actions, out, 1);
+    }
+    if (aux->infile != NULL)
+        posix_spawn_file_actions_addopen(&actions, 0, aux->infile, O_RDONLY, 0400); // owner read
+    if (aux->outfile != NULL)
+        posix_spawn_file_actions_addopen(&actions, 1, aux->outfile, O_WRONLY | O_TRUNC | O_CREAT, 0200); // owner write
+    if (aux->errfile != NULL)
+        posix_spawn_file_actions_addopen(&actions, 2, aux->errfile, O_WRONLY | O_TRUNC | O_CREAT, 0200); // owner write
+
+    // the shell ignores SIGPIPE (builtin threads get EPIPE instead), SIGINT and
+    // SIGTSTP (at the prompt) and SIGTTOU (to take the terminal back) and blocks
+    // SIGCHLD (read from a signalfd), the child must not: ignored signals survive
+    // exec, and a job that ignores ^Z or a background write could never stop
+    posix_spawnattr_init(&attr);
+    sigemptyset(&def);
+    sigaddset(&def, SIGPIPE);
+    sigaddset(&def, SIGINT);
+    sigaddset(&def, SIGTSTP);
+    sigaddset(&def, SIGTTOU);
+    sigaddset(&def, SIGTTIN);
+    posix_spawnattr_setsigdefault(&attr, &def);
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    if (pgid != NULL)
+    {
+        posix_spawnattr_setpgroup(&attr, *pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    err = posix_spawn(&pid, prog, &actions, &attr, aux->argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0)
+    {
+        fprintf(stderr, "%s: %s\n", aux->argv[0], strerror(err));
+        return -1;
+    }
+    if (pgid != NULL && *pgid == 0)
+        *pgid = pid;
+    return pid;
+}
+
+/*
+ * @brief run a builtin as a stage of a pipeline
+ * @param BUILTIN* b - builtin
+ * @param CMD* aux - command with its redirections
+ * @param int in - pipe to use as stdin or -1
+ * @param int out - pipe to use as stdout or -1
+ * @param pid_t* pgid - process group to join (0 = new group, set to the pid) or NULL
+ * @return pid of the child or -1
+ *
+ * there is nothing to exec, so this one needs a real fork()
+ */
+pid_t spawn_builtin(BUILTIN *b, CMD *aux, int in, int out, pid_t *pgid)
+{
+    pid_t pid;
+
+    fflush(stdout);
+    fflush(stderr);
+    if ((pid = fork()) == -1)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        if (pgid != NULL)
+            setpgid(0, *pgid);
+        if (in != -1)
+            dup2(in, 0);
+        if (out != -1)
+            dup2(out, 1);
+        closefrom(3); // no exec to close the O_CLOEXEC pipes of the shell
+        if (redirect_fd(aux->infile, 0, NULL) == -1 ||
+            redirect_fd(aux->outfile, 1, NULL) == -1 ||
+            redirect_fd(aux->errfile, 2, NULL) == -1)
+            _exit(1);
+        signal(SIGPIPE, SIG_DFL); // the same defaults as spawn_command
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        int status = b->fn(aux, stdout);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status);
+    }
+    if (pgid != NULL)
+    {
+        setpgid(pid, *pgid); // also here, whoever runs first
+        if (*pgid == 0)
+            *pgid = pid;
+    }
+    return pid;
+}
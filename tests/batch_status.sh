@@ -0,0 +1,45 @@
+#!/bin/sh
+# Exit status of msh in batch mode (-c, script, stdin): the status of the
+# last line, 2 for a line with a syntax error.
+#
+# usage: tests/batch_status.sh (run by make test)
+
+MSH=${MSH:-./output}
+fails=0
+
+# expect STATUS LINE - run LINE with -c and on stdin, compare the status
+expect() {
+    $MSH -c "$2" >/dev/null 2>&1
+    got=$?
+    printf '%s\n' "$2" | $MSH >/dev/null 2>&1
+    piped=$?
+    if [ $got -ne $1 ] || [ $piped -ne $1 ]; then
+        echo "FAIL: '$2' exited $got (-c) and $piped (stdin), expected $1"
+        fails=$((fails + 1))
+    fi
+}
+
+expect 0 'true'
+expect 1 'false'
+expect 0 ''
+expect 2 '| ls'
+expect 2 "echo 'x"
+expect 2 'echo "x'
+expect 2 'ls >'
+expect 2 'cat <'
+expect 2 'ls 2>'
+expect 2 'ls | | wc'
+expect 2 'ls |'
+expect 0 'echo ok | cat'
+
+# a syntax error does not stop a script, the last line gives the status
+script=$(mktemp)
+printf '| ls\ntrue\n' > "$script"
+$MSH "$script" >/dev/null 2>&1 || { echo "FAIL: script ending with true exited $?"; fails=$((fails + 1)); }
+printf 'true\n| ls\n' > "$script"
+$MSH "$script" >/dev/null 2>&1
+[ $? -eq 2 ] || { echo "FAIL: script ending with a syntax error did not exit 2"; fails=$((fails + 1)); }
+rm -f "$script"
+
+[ $fails -eq 0 ] && echo "batch_status: ok"
+exit $((fails > 0))
@@ -0,0 +1,195 @@
+/*
+ * @file timing.c
+ * @brief Resource accounting of the pipelines (time prefix, set timing/timelog)
+ *
+ * Every stage of a timed pipeline gets a STAGETIME: the children are
+ * collected with wait4() so their rusage comes with the exit status, the
+ * builtin stages take the difference of getrusage(RUSAGE_THREAD) around the
+ * builtin, plus the usage of the workers of the pools it started (myls -R,
+ * myfind): pool_create() takes the STAGETIME of timing_stage, every worker
+ * adds its own RUSAGE_THREAD when it leaves and pool_wait() adds them up. The wall time of a stage goes from its launch to its exit: the
+ * children are collected from the process group of the pipeline as they
+ * exit, whatever their order in it.
+ *
+ * The breakdown goes to stderr; with set timelog FILE one JSON object per
+ * pipeline is also appended to FILE.
+ */
+
+#include "header.h"
+
+__thread STAGETIME *timing_stage = NULL; // stage timed by this thread, for the pools it starts
+
+/*
+ * @brief start the accounting of a stage
+ * @param STAGETIME* t - record to initialize
+ * @param CMD* cmd - command of the stage
+ */
+void timing_begin(STAGETIME *t, CMD *cmd)
+{
+    memset(t, 0, sizeof(STAGETIME));
+    t->cmd = cmd;
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/*
+ * @brief the stage is done
+ * @param STAGETIME* t - record
+ * @param int status - exit status (0-255)
+ */
+void timing_end(STAGETIME *t, int status)
+{
+    clock_gettime(CLOCK_MONOTONIC, &t->end);
+    t->status = status;
+}
+
+/*
+ * @brief add the times and context switches of ru to sum
+ */
+void timing_add(struct rusage *sum, const struct rusage *ru)
+{
+    timeradd(&sum->ru_utime, &ru->ru_utime, &sum->ru_utime);
+    timeradd(&sum->ru_stime, &ru->ru_stime, &sum->ru_stime);
+    sum->ru_nvcsw += ru->ru_nvcsw;
+    sum->ru_nivcsw += ru->ru_nivcsw;
+}
+
+/*
+ * @brief add the usage of the calling thread since before was taken
+ * @param STAGETIME* t - record to fill (may already have the usage of pool workers)
+ * @param struct rusage* before - getrusage(RUSAGE_THREAD) at the start of the stage
+ */
+void timing_usage(STAGETIME *t, const struct rusage *before)
+{
+    struct rusage now, delta = {0};
+
+    getrusage(RUSAGE_THREAD, &now);
+    timersub(&now.ru_utime, &before->ru_utime, &delta.ru_utime);
+    timersub(&now.ru_stime, &before->ru_stime, &delta.ru_stime);
+    delta.ru_nvcsw = now.ru_nvcsw - before->ru_nvcsw;
+    delta.ru_nivcsw = now.ru_nivcsw - before->ru_nivcsw;
+    timing_add(&t->ru, &delta);
+    t->ru.ru_maxrss = now.ru_maxrss; // of the whole shell, there is no per thread peak
+}
+
+static double seconds(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static double elapsed(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec) + (b->tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/*
+ * @brief write a JSON string
+ */
+static void json_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s; s++)
+    {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * @brief append one line to the timelog file
+ */
+static void timing_log(STAGETIME *t, int n, STAGETIME *total)
+{
+    FILE *fp = fopen(options.timelog, "ae");
+    struct timespec now;
+    int i, j;
+
+    if (fp == NULL)
+    {
+        perror(options.timelog);
+        return;
+    }
+    clock_gettime(CLOCK_REALTIME, &now);
+    fprintf(fp, "{\"time\":%ld.%03ld,\"status\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,"
+                "\"maxrss_kb\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld,\"stages\":[",
+            (long)now.tv_sec, now.tv_nsec / 1000000, total->status,
+            elapsed(&total->start, &total->end), seconds(&total->ru.ru_utime), seconds(&total->ru.ru_stime),
+            total->ru.ru_maxrss, total->ru.ru_nvcsw, total->ru.ru_nivcsw);
+    for (i = 0; i < n; i++)
+    {
+        fprintf(fp, "%s{\"argv\":[", i ? "," : "");
+        for (j = 0; t[i].cmd->argv[j] != NULL; j++)
+        {
+            if (j)
+                fputc(',', fp);
+            json_string(fp, t[i].cmd->argv[j]);
+        }
+        fprintf(fp, "],\"pid\":%d,\"status\":%d,\"real\":%.6f,\"user\":%.6f,\"sys\":%.6f,"
+                    "\"maxrss_kb\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}",
+                (int)t[i].pid, t[i].status, elapsed(&t[i].start, &t[i].end),
+                seconds(&t[i].ru.ru_utime), seconds(&t[i].ru.ru_stime),
+                t[i].ru.ru_maxrss, t[i].ru.ru_nvcsw, t[i].ru.ru_nivcsw);
+    }
+    fprintf(fp, "]}\n");
+    fclose(fp);
+}
+
+static void timing_line(STAGETIME *t, const char *label)
+{
+    int j;
+
+    fprintf(stderr, "%8.3f %8.3f %8.3f %8ldk %6ld %6ld %6d  ",
+            elapsed(&t->start, &t->end), seconds(&t->ru.ru_utime), seconds(&t->ru.ru_stime),
+            t->ru.ru_maxrss, t->ru.ru_nvcsw, t->ru.ru_nivcsw, t->status);
+    if (label != NULL)
+        fputs(label, stderr);
+    else
+        for (j = 0; t->cmd->argv[j] != NULL; j++)
+            fprintf(stderr, "%s%s", j ? " " : "", t->cmd->argv[j]);
+    fputc('\n', stderr);
+}
+
+/*
+ * @brief print the breakdown of a pipeline (and log it)
+ * @param STAGETIME* t - one record per stage, all of them ended
+ * @param int n - number of stages
+ *
+ * the total is the wall time of the whole pipeline, the sum of the CPU
+ * times and context switches and the largest max RSS
+ */
+void timing_report(STAGETIME *t, int n)
+{
+    STAGETIME total;
+    int i;
+
+    memset(&total, 0, sizeof(total));
+    total.start = t[0].start;
+    total.end = t[0].end;
+    total.status = t[n - 1].status;
+    for (i = 0; i < n; i++)
+    {
+        if (elapsed(&total.end, &t[i].end) > 0)
+            total.end = t[i].end;
+        timeradd(&total.ru.ru_utime, &t[i].ru.ru_utime, &total.ru.ru_utime);
+        timeradd(&total.ru.ru_stime, &t[i].ru.ru_stime, &total.ru.ru_stime);
+        if (t[i].ru.ru_maxrss > total.ru.ru_maxrss)
+            total.ru.ru_maxrss = t[i].ru.ru_maxrss;
+        total.ru.ru_nvcsw += t[i].ru.ru_nvcsw;
+        total.ru.ru_nivcsw += t[i].ru.ru_nivcsw;
+    }
+
+    fflush(stdout);
+    fprintf(stderr, "%8s %8s %8s %9s %6s %6s %6s  %s\n",
+            "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "status", "stage");
+    for (i = 0; i < n; i++)
+        timing_line(&t[i], NULL);
+    if (n > 1)
+        timing_line(&total, "total");
+    if (options.timelog != NULL)
+        timing_log(t, n, &total);
+}